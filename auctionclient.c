@@ -14,16 +14,20 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <csse2310a3.h>
 #include <csse2310a4.h>
 #include <signal.h>
 
 // constants
-#define USAGE_ERR "Usage: auctionclient portno\n"
+#define USAGE_ERR "Usage: auctionclient [--batch] (portno | --unix path)\n"
 #define USAGE_ERR_CODE 20
 #define CONNECTION_ERR "auctionclient: cannot connect to port %s\n"
 #define CONNECTION_ERR_CODE 13
+#define UNIX_CONNECTION_ERR "auctionclient: cannot connect to socket %s\n"
 #define CONNECTION_CLOSE "auctionclient: server connection closed\n"
 #define CONNECTION_CLOSE_CODE 18
 #define AUCTION_EXIT "Exiting with auction still in progress\n"
@@ -42,14 +46,41 @@
 #define SMALL_BUFFER 4
 #define BUFFER 5
 #define LARGE_BUFFER 7
+#define BATCH "--batch"
+#define UNIX "--unix"
+#define BATCH_BUFFER (1 << 16)
+#define OPEN_TABLE_SIZE 64
+#define ROLE_SELLER 1
+#define ROLE_BIDDER 2
+
+// One item name this client has (or had) an interest in
+typedef struct {
+    char* name;
+    int roles;
+} OpenEntry;
+
+// Hash table of open auctions keyed by item name. Entries whose roles drop
+// to zero are kept as reusable slots until the table is rebuilt.
+typedef struct {
+    OpenEntry* entries;
+    int size;
+    int used;
+    int live;
+} OpenAuctions;
 
 // Structure that holds all the data for the client to connect to the server
 typedef struct {
     const char* portName;
+    const char* unixPath;
     int socket;
     FILE* to;
     FILE* from;
-    volatile int liveAuction;
+    bool batch;
+    unsigned long sent;
+    unsigned long received;
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+    OpenAuctions open;
 } ClientData;
 
 // functions
@@ -63,52 +94,275 @@ void usage_err() {
     exit(USAGE_ERR_CODE);
 }
 
-/* command_line_check()
+/* hash_name()
 * −−−−−−−−−−−−−−−
-* Checks the command line arguments, sets up the client data for the 
-* auction client and connects to the port provided.
-* 
-* data: The client data struct to be set up.
-* argc: The number of command line arguments.
-* argv: The array of command line arguments.
+* FNV-1a hash of an item name.
+*
+* name: The item name (not necessarily null terminated).
+* len: The length of the item name.
+*
+* Returns: the hash value
+*/
+unsigned int hash_name(const char* name, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* open_slot()
+* −−−−−−−−−−−−−−−
+* Finds the slot for an item name in the open auction table, or the empty
+* slot where it would be inserted.
+*
+* open: The open auction table.
+* name: The item name (not necessarily null terminated).
+* len: The length of the item name.
+*
+* Returns: pointer to the slot
+*/
+OpenEntry* open_slot(OpenAuctions* open, const char* name, int len) {
+    unsigned int i = hash_name(name, len) & (open->size - 1);
+    while (open->entries[i].name != NULL) {
+        if ((int)strlen(open->entries[i].name) == len &&
+                strncmp(open->entries[i].name, name, len) == 0) {
+            break;
+        }
+        i = (i + 1) & (open->size - 1);
+    }
+    return &open->entries[i];
+}
+
+/* open_rebuild()
+* −−−−−−−−−−−−−−−
+* Rebuilds the open auction table, dropping closed entries and growing it if
+* it is mostly full of open ones.
+*
+* open: The open auction table.
+*/
+void open_rebuild(OpenAuctions* open) {
+    OpenAuctions old = *open;
+    open->size = OPEN_TABLE_SIZE;
+    while (open->size < old.live * 4) {
+        open->size *= 2;
+    }
+    open->entries = calloc(open->size, sizeof(OpenEntry));
+    open->used = 0;
+    for (int i = 0; i < old.size; i++) {
+        if (old.entries[i].name == NULL) {
+            continue;
+        }
+        if (old.entries[i].roles == 0) {
+            free(old.entries[i].name);
+            continue;
+        }
+        *open_slot(open, old.entries[i].name, 
+                strlen(old.entries[i].name)) = old.entries[i];
+        open->used++;
+    }
+    free(old.entries);
+}
+
+/* open_update()
+* −−−−−−−−−−−−−−−
+* Sets or clears one of this client's roles (seller/bidder) on an item and
+* keeps the count of open auctions in step.
+*
+* open: The open auction table.
+* name: The item name (not necessarily null terminated).
+* len: The length of the item name.
+* role: ROLE_SELLER or ROLE_BIDDER.
+* set: true to set the role, false to clear it.
+*/
+void open_update(OpenAuctions* open, const char* name, int len, int role,
+        bool set) {
+    if (set && (open->used + 1) * 4 > open->size * 3) {
+        open_rebuild(open);
+    }
+    OpenEntry* entry = open_slot(open, name, len);
+    if (entry->name == NULL) {
+        if (!set) {
+            return;
+        }
+        entry->name = strndup(name, len);
+        entry->roles = 0;
+        open->used++;
+    }
+    bool wasOpen = entry->roles != 0;
+    entry->roles = set ? (entry->roles | role) : (entry->roles & ~role);
+    open->live += (entry->roles != 0) - wasOpen;
+}
+
+/* track_response()
+* −−−−−−−−−−−−−−−
+* Updates the open auction table from a server line.
+*
+* data: The client data.
+* response: The line received from the server.
+*
+* Returns: true if the line is a reply to one of our requests, false if it
+* is an unsolicited notification
+*/
+bool track_response(ClientData* data, const char* response) {
+    const char* name = strchr(response, ' ');
+    int len = 0;
+    if (name != NULL) {
+        name++;
+        len = strcspn(name, " ");
+    }
+    bool reply = true;
+    int role = 0;
+    bool set = false;
+    if (strncmp(response, BID, SMALL_BUFFER) == 0) {
+        role = ROLE_BIDDER;
+        set = true;
+    } else if (strncmp(response, LISTED, LARGE_BUFFER) == 0) {
+        role = ROLE_SELLER;
+        set = true;
+    } else if ((strncmp(response, OUTBID, LARGE_BUFFER) == 0) ||
+            (strncmp(response, WON, SMALL_BUFFER) == 0)) {
+        role = ROLE_BIDDER;
+        reply = false;
+    } else if ((strncmp(response, UNSOLD, LARGE_BUFFER) == 0) ||
+            (strncmp(response, SOLD, BUFFER) == 0)) {
+        role = ROLE_SELLER;
+        reply = false;
+    }
+    if (role != 0 && name != NULL) {
+        pthread_mutex_lock(&data->lock);
+        open_update(&data->open, name, len, role, set);
+        pthread_mutex_unlock(&data->lock);
+    }
+    return reply;
+}
+
+/* live_auctions()
+* −−−−−−−−−−−−−−−
+* Returns the number of auctions this client is still selling or leading.
+*
+* data: The client data.
+*/
+int live_auctions(ClientData* data) {
+    pthread_mutex_lock(&data->lock);
+    int live = data->open.live;
+    pthread_mutex_unlock(&data->lock);
+    return live;
+}
+
+/* connect_unix()
+* −−−−−−−−−−−−−−−
+* Connects to the auctioneer's Unix domain socket. A path starting with '@'
+* names a socket in the abstract namespace.
 * 
-* Returns: The client data struct with the socket and file descriptors set up.
-* Errors: if insufficient or too many arguments are given or not a valid port 
-* number is given.
+* path: The socket path.
+*
+* Returns: the connected socket
+* Errors: if the path is too long or the socket can't be connected to
 */
-ClientData command_line_check(ClientData data, int argc, char* argv[]) {
-    if (argc != 2) {
-        usage_err();
+int connect_unix(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int pathLen = strlen(path);
+    if (pathLen >= (int)sizeof(addr.sun_path)) {
+        fprintf(stderr, UNIX_CONNECTION_ERR, path);
+        exit(CONNECTION_ERR_CODE);
     }
-    data.portName = argv[1];
+    memcpy(addr.sun_path, path, pathLen);
+    socklen_t addrLen = offsetof(struct sockaddr_un, sun_path) + pathLen;
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+    } else {
+        addrLen++;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*)&addr, addrLen)) {
+        fprintf(stderr, UNIX_CONNECTION_ERR, path);
+        exit(CONNECTION_ERR_CODE);
+    }
+    return fd;
+}
+
+/* connect_tcp()
+* −−−−−−−−−−−−−−−
+* Connects to the auctioneer on the given port of localhost.
+* 
+* portName: The port number.
+*
+* Returns: the connected socket
+* Errors: if the port can't be connected to
+*/
+int connect_tcp(const char* portName) {
     struct addrinfo* ai = NULL;
     struct addrinfo hints;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET; //IPv4
     hints.ai_socktype = SOCK_STREAM; //TCP
     int err;
-    if ((err = getaddrinfo(LOCALHOST, data.portName, &hints, &ai))) {
-        fprintf(stderr, CONNECTION_ERR, data.portName);
+    if ((err = getaddrinfo(LOCALHOST, portName, &hints, &ai))) {
+        fprintf(stderr, CONNECTION_ERR, portName);
         exit(CONNECTION_ERR_CODE);
     }
 
     // if valid address then connect
-    data.socket = socket(AF_INET, SOCK_STREAM, 0); // 0 use default protocol 
-    if (connect(data.socket, ai->ai_addr, sizeof(struct sockaddr))) { 
-        fprintf(stderr, CONNECTION_ERR, data.portName);
+    int fd = socket(AF_INET, SOCK_STREAM, 0); // 0 use default protocol 
+    if (connect(fd, ai->ai_addr, sizeof(struct sockaddr))) { 
+        fprintf(stderr, CONNECTION_ERR, portName);
         exit(CONNECTION_ERR_CODE);
     }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/* command_line_check()
+* −−−−−−−−−−−−−−−
+* Checks the command line arguments, sets up the client data for the 
+* auction client and connects to the port (or Unix socket) provided.
+* 
+* data: The client data struct to be set up.
+* argc: The number of command line arguments.
+* argv: The array of command line arguments.
+* 
+* Returns: The client data struct with the socket and file descriptors set up.
+* Errors: if insufficient or too many arguments are given or not a valid port 
+* number is given.
+*/
+ClientData command_line_check(ClientData data, int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], BATCH) == 0 && !data.batch) {
+            data.batch = true;
+        } else if (strcmp(argv[i], UNIX) == 0 && i + 1 < argc && 
+                !data.unixPath && !data.portName && argv[i + 1][0] != '\0') {
+            data.unixPath = argv[++i];
+        } else if (strcmp(argv[i], UNIX) != 0 && !data.unixPath && 
+                !data.portName) {
+            data.portName = argv[i];
+        } else {
+            usage_err();
+        }
+    }
+    if (!data.unixPath && !data.portName) {
+        usage_err();
+    }
+    data.socket = data.unixPath ? connect_unix(data.unixPath) : 
+            connect_tcp(data.portName);
     data.to = fdopen(data.socket, "w");    
     data.from = fdopen(dup(data.socket), "r");
-
-    freeaddrinfo(ai);
+    if (data.batch) {
+        setvbuf(data.to, NULL, _IOFBF, BATCH_BUFFER);
+        setvbuf(data.from, NULL, _IOFBF, BATCH_BUFFER);
+    }
     return data;
 }
 
 /* to_server()
 * −−−−−−−−−−−−−−−
-* This function is responsible for reading the server response and counting 
-* live auctions, protected by mutex.
+* This function is responsible for reading the server response and tracking
+* live auctions per item name.
+* In batch mode each reply is prefixed with the number of the request it
+* answers and notifications with "*", and output is only flushed once every
+* request sent so far has been answered.
 * 
 * arg: A void pointer to the client data.
 * Return: void* Returns NULL.
@@ -117,30 +371,73 @@ ClientData command_line_check(ClientData data, int argc, char* argv[]) {
 void* to_server(void* arg) {
     ClientData* data = (ClientData*) arg;
     char* serverResponse;
-    pthread_mutex_t liveAuctionMutex = PTHREAD_MUTEX_INITIALIZER;
     while ((serverResponse = read_line(data->from))) {
-        pthread_mutex_lock(&liveAuctionMutex);
-        if ((strncmp(serverResponse, BID, SMALL_BUFFER) == 0) ||
-                (strncmp(serverResponse, LISTED, LARGE_BUFFER) == 0)) {
-            data->liveAuction++;
-        } else if ((strncmp(serverResponse, OUTBID, LARGE_BUFFER) == 0) ||
-                (strncmp(serverResponse, WON, SMALL_BUFFER) == 0) ||
-                (strncmp(serverResponse, UNSOLD, LARGE_BUFFER) == 0) ||
-                (strncmp(serverResponse, SOLD, BUFFER) == 0)) {
-            data->liveAuction--;
+        bool reply = track_response(data, serverResponse);
+        if (!data->batch) {
+            fprintf(stdout, "%s\n", serverResponse);
+            fflush(stdout);
+        } else if (reply) {
+            pthread_mutex_lock(&data->lock);
+            data->received++;
+            fprintf(stdout, "%lu %s\n", data->received, serverResponse);
+            if (data->received == data->sent) {
+                fflush(stdout);
+                pthread_cond_signal(&data->drained);
+            }
+            pthread_mutex_unlock(&data->lock);
+        } else {
+            fprintf(stdout, "* %s\n", serverResponse);
         }
-        pthread_mutex_unlock(&liveAuctionMutex);
-        fprintf(stdout, "%s\n", serverResponse);
-        fflush(stdout);
         free(serverResponse);
     }
     if (serverResponse == NULL) {
+        fflush(stdout);
         fprintf(stderr, CONNECTION_CLOSE);
         exit(CONNECTION_CLOSE_CODE);
     }
     return NULL;
 }
 
+/* run_batch()
+* −−−−−−−−−−−−−−−
+* Pipelines every command from stdin to the server without waiting for
+* replies, then waits until all of them have been answered.
+* A "quit" line ends the input early.
+*
+* data: The client data.
+*/
+void run_batch(ClientData* data) {
+    char* line;
+    while ((line = read_line(stdin))) {
+        if (strcmp(line, QUIT) == 0) {
+            free(line);
+            break;
+        } else if ((strncmp(line, EMPTY, 1) != 0) &&
+                (strncmp(line, HASH, 1) != 0)) {
+            fputs(line, data->to);
+            putc('\n', data->to);
+            pthread_mutex_lock(&data->lock);
+            data->sent++;
+            pthread_mutex_unlock(&data->lock);
+        }
+        free(line);
+    }
+    fflush(data->to);
+
+    pthread_mutex_lock(&data->lock);
+    while (data->received < data->sent) {
+        pthread_cond_wait(&data->drained, &data->lock);
+    }
+    int live = data->open.live;
+    fflush(stdout);
+    pthread_mutex_unlock(&data->lock);
+    if (live > 0) {
+        fprintf(stderr, AUCTION_EXIT);
+        exit(AUCTION_EXIT_CODE);
+    }
+    exit(0);
+}
+
 /* sigpipe_handler()
 * −----------------
 * Handling SIGPIPE signal
@@ -160,23 +457,35 @@ void sigpipe_handler(int signum) {
 * Sets up the signal handler for SIGPIPE
 * init the ClientData struct,
 * Creates a thread to read from the server, while main reads from stdin and 
-* handles inputs.
+* handles inputs (or pipelines them all in batch mode).
 *
 * argc: The number of command line arguments.
 * argv: The array of command line arguments.
 */
 int main(int argc, char* argv[]) {
     signal(SIGPIPE, sigpipe_handler);
-    ClientData data = {.portName = NULL, .liveAuction = 0};
+    ClientData data = {.portName = NULL, .unixPath = NULL, .batch = false, 
+            .sent = 0, .received = 0,
+            .lock = PTHREAD_MUTEX_INITIALIZER,
+            .drained = PTHREAD_COND_INITIALIZER};
     data = command_line_check(data, argc, argv);
+    data.open.size = OPEN_TABLE_SIZE;
+    data.open.entries = calloc(OPEN_TABLE_SIZE, sizeof(OpenEntry));
+    if (data.batch) {
+        setvbuf(stdin, NULL, _IOFBF, BATCH_BUFFER);
+        setvbuf(stdout, NULL, _IOFBF, BATCH_BUFFER);
+    }
 
     pthread_t toServer;
     pthread_create(&toServer, NULL, to_server, &data);
+    if (data.batch) {
+        run_batch(&data);
+    }
 
     char* line;
     while ((line = read_line(stdin))) {
         if (strcmp(line, QUIT) == 0) {
-            if (data.liveAuction > 0) {
+            if (live_auctions(&data) > 0) {
                 fprintf(stdout, AUCTION_PROG);
                 fflush(stdout);
             } else {
@@ -192,7 +501,7 @@ int main(int argc, char* argv[]) {
     }
     
     if (feof(stdin)) {
-        if (data.liveAuction > 0) {
+        if (live_auctions(&data) > 0) {
             fprintf(stderr, AUCTION_EXIT);
             exit(AUCTION_EXIT_CODE);
         } else {
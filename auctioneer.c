@@ -6,6 +6,7 @@
  */
 
 // includes
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -21,55 +22,192 @@
 #include <signal.h>
 #include <csse2310a3.h>
 #include <csse2310a4.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <math.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_RECV_MULTISHOT)
+#define HAVE_URING 1
+#endif
+#endif
+#endif
 
 // constants
-#define USAGE_ERR "Usage: auctioneer [--max connections] [--listenon portno]\n"
+#define USAGE_ERR "Usage: auctioneer [--max connections] [--listenon portno] \
+[--uring] [--traderate n] [--listrate n] [--inflight n] [--maxbacklog bytes] \
+[--history file] [--listen-unix path] [--handoff path] [--takeover path] \
+[--capture file]\n"
 #define USAGE_ERR_CODE 8
 #define INVALID_PORT "auctioneer: socket can't be listened on\n"
 #define INVALID_PORT_CODE 11
-#define MIN_ARGS 2
-#define MAX_ARGS 5
+#define INVALID_UNIX "auctioneer: unix socket can't be listened on\n"
+#define HISTORY_ERR "auctioneer: history file can't be opened\n"
+#define HISTORY_ERR_CODE 12
+#define HANDOFF_ERR "auctioneer: can't take over from the old server\n"
+#define HANDOFF_ERR_CODE 13
+#define CAPTURE_ERR "auctioneer: capture file can't be opened\n"
+#define CAPTURE_ERR_CODE 14
 #define MAX_PORT 65535
 #define MIN_PORT 1024
 #define LISTEN_ON "--listenon"
 #define MAX "--max"
+#define URING "--uring"
+#define TRADE_RATE "--traderate"
+#define LIST_RATE "--listrate"
+#define IN_FLIGHT "--inflight"
+#define MAX_BACKLOG "--maxbacklog"
+#define HISTORY "--history"
+#define LISTEN_UNIX "--listen-unix"
+#define HANDOFF "--handoff"
+#define TAKEOVER "--takeover"
+#define CAPTURE "--capture"
+#define CAPTURE_MAGIC "AUCTRC01"
+#define CAPTURE_MAGIC_LEN 8
+#define CAPTURE_FLUSH_SIZE (1 << 16)
+#define CAPTURE_FLUSH_US 1000000
+#define HANDOFF_FORMAT 1
+#define HANDOFF_FD_BATCH 200
+#define HANDOFF_RETRY_US 100000
+#define HANDOFF_QUIESCE_S 5
+#define GONE_CLIENT -1
+#define SUN_PATH_LEN sizeof(((struct sockaddr_un*)0)->sun_path)
+#define UNSET_LIMIT -1
 #define DEFAULT_PORT "0"
 #define SELL_ARGS_NO 4
 #define RESERVE 2
 #define DURATION 3
 #define SELL_NAME 1
 #define REJECTED ":rejected"
-#define BUFFER_LISTED 9
 #define LISTED ":listed %s"
 #define INVALID ":invalid"
-#define SPACE " "
+#define BUSY ":busy"
 #define BID_ARGS 3
 #define BID_ARGS_NO 2
 #define BID_NAME_ARGS_NO 1
 #define NAME_BUFFER 6
-#define BREAKER "|"
-#define MAX_INPUT 4
+#define OUTBID ":outbid %s %d"
+#define MAX_INPUT_FIELDS 4
 #define BUFFER_LEN 5
-#define BUFFER_LARGE 8
 #define BLANK ' '
+#define SPACE " "
+#define NAME_INLINE 16
+#define MIN_ITEMS 64
+#define EXPIRY_BLOCK 64
+#define EXPIRY_INTERVAL_US 100000
+#define CLOSED_EXPIRY INFINITY
+#define ADVANCE_ARGS_NO 2
+#define ADVANCED ":advanced"
+#define HISTORY_ARGS 2
+#define HISTORY_HEADER sizeof(long)
+#define HISTORY_MIN_SIZE (1 << 20)
+#define HISTORY_MIN_INDEX 1024
+#define VARINT_MAX 10
+#define JOURNAL_SIZE 4096
+#define SINCE_ARGS_NO 3
+#define CHANGES ":changes %lu"
+#define SNAPSHOT ":snapshot %lu"
+#define CLOSED " closed|"
+#define CLIENT_BUF_SIZE 4096
+#define NOTICE_BUFFER 256
+#define URING_ENTRIES 256
+#define URING_BUFS 256
+#define URING_BUF_SIZE 4096
+#define URING_BGID 0
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_WAKE 4
+#define URING_OP_CANCEL 5
+#define URING_OP_NOTICE 6
+#define URING_OP_BITS 8
+
+// Name of an item, stored inline when it fits
+typedef struct {
+    char inlineName[NAME_INLINE];
+    char* longName;
+} ItemName;
 
-// Structure that holds all the data for each item
+// Fields of an item only needed once it has been found
 typedef struct {
-    int highestBid;
+    ItemName name;
     int highestBidder;
     int owner;
     int reserve;
-    double duration;
-    char* itemName;
-    bool removed;
-    int charLen;
-    int reserveLen;
-} Item;
-
-// Structure that holds items in auction
+    int ceiling;
+} ItemInfo;
+
+// Entry of the change journal: the name of an item that was listed, bid on
+// or closed, and the version the change was given. The name buffer is 
+// reused (grown when needed) as the journal wraps.
+typedef struct {
+    unsigned long version;
+    char* name;
+    int nameCap;
+} Change;
+
+// Append-only log of closed auctions. Each record is varint encoded as
+// <bytes back to the previous record for the name, or 0> <reserve> <price>
+// <name length> <name>, after a header holding the log length.
+// index is an open-addressing table of the latest record offset per name.
+typedef struct {
+    char* base;
+    long len;
+    long cap;
+    int fd;
+    long* index;
+    int indexSize;
+    int numNames;
+} History;
+
+#ifdef VIRTUAL_CLOCK
+// Virtual auction time for test builds. It starts at the real time and only
+// moves when advanced; swept is the time of the last expiry sweep, which 
+// advancing waits for. advanced is signalled both ways, under the auction 
+// lock.
+typedef struct {
+    double now;
+    double swept;
+    pthread_cond_t advanced;
+} Clock;
+#endif
+
+// Structure that holds the items in auction that are still open.
+// Fields read by full-table scans (expiry, list length, name lookup) are 
+// kept in their own packed arrays, indexed like info. slots is an 
+// open-addressing index of item index + 1 (0 when empty) by name hash.
+// Every change bumps version and is kept in the journal ring, the slot for
+// a version being version % JOURNAL_SIZE. Items are kept in the order they
+// were listed: a closed item stays as a gap (expiry CLOSED_EXPIRY, counted
+// in numClosed) until the expiry sweep compacts the arrays.
 typedef struct {
     int numItems;
-    Item* items;
+    int numClosed;
+    int capacity;
+    double* expiry;
+    int* highestBid;
+    int* listLen;
+    unsigned int* nameHash;
+    ItemInfo* info;
+    int* slots;
+    int slotsSize;
+    unsigned long version;
+    Change journal[JOURNAL_SIZE];
+    History history;
+#ifdef VIRTUAL_CLOCK
+    Clock clock;
+#endif
     pthread_mutex_t lock;
 } Auction;
 
@@ -81,35 +219,142 @@ typedef struct {
     unsigned int bidAccepted;
 } Stat;
 
-// Structure that keeps track of client connected
+// Overload protection settings (0 means unlimited) shared by all clients
+typedef struct {
+    int tradeRate;
+    int listRate;
+    int maxInFlight;
+    int maxBacklog;
+    int inFlight;
+} Limits;
+
+// Token bucket holding at most one second's worth of requests
+typedef struct {
+    double tokens;
+    double last;
+} Bucket;
+
+// Structure that keeps track of client connected. A client's id is its 
+// position in the registry + 1, so ids are never reused like fds are. The
+// registry is only touched under the auction lock, as notices are sent 
+// while holding it.
 typedef struct {
-    int id;
+    int fd;
     bool active;
 } ActiveClient;
 
+// A client connection being handed over, with the bytes read from it that
+// do not yet make up a full request. client is its registry id, or 0 if it
+// was still waiting for a connection slot.
+typedef struct {
+    int fd;
+    int client;
+    char* in;
+    int inLen;
+} HandoffConn;
+
+// Zero-downtime handoff state. Once a successor connects to the control 
+// socket, a byte is written to the wake pipe and every accept loop and 
+// client thread parks before reading again; the parked connections are 
+// collected in conns. If the successor fails to take over, failures is 
+// bumped and everything that parked carries on. A process taking over 
+// keeps the connections it was given in conns until it starts serving them.
+typedef struct {
+    char* path;
+    char* takeoverPath;
+    int listenFd;
+    int wake[2];
+    bool active;
+    int acceptors;
+    int parkedAcceptors;
+    bool loopParked;
+    unsigned long failures;
+    HandoffConn* conns;
+    int numConns;
+} Handoff;
+
+// Traffic capture trace, opened for appending. The file starts with 
+// CAPTURE_MAGIC; each record is the varints wall-clock time in 
+// microseconds, session id and line length + 1 (0 for the end of the 
+// session), then the request line. Threads buffer their own records and
+// append them in batches, so records are only ordered within a session.
+typedef struct {
+    char* path;
+    int fd;
+    unsigned long nextSession;
+} Capture;
+
+// This thread's capture records that are not yet in the trace
+typedef struct {
+    char* buf;
+    int len;
+    int cap;
+    long oldest;
+} CaptureBuf;
+
+static __thread CaptureBuf captureBuf;
+
+// Notices for clients of the io_uring loop, which is the only thread that 
+// writes to them. Other threads queue records of the client id, the length
+// and the notice under the auction lock and wake the loop through the wake
+// pipe; the loop moves them onto the clients' output. wake[1] is -1 while
+// clients are served by threads, which write notices directly.
+typedef struct {
+    int wake[2];
+    pthread_t loop;
+    char* buf;
+    int len;
+    int cap;
+} Notices;
+
 // Structure that holds all the data
 typedef struct {
     int maxConnections;
     char* portNumber;
+    char* historyPath;
+    char* unixPath;
+    bool useUring;
     int fdServer;
+    int fdUnix;
     int numCon;
     int fdptr;
     int totalCon;
     pthread_mutex_t lock;
+    pthread_cond_t slotFree;
     ActiveClient* clients;
     Auction* auction;
     Stat* stats;
+    Limits limits;
+    Handoff handoff;
+    Capture capture;
+    Notices notices;
 } AuctionData;
 
 // Structure that holds all the data for the client to connect 
 typedef struct {
     int fdptr;
+    int client;
     int* curCon;
     int* totalCon;
     pthread_mutex_t* lock;
+    pthread_cond_t* slotFree;
     Auction* auction;
     Stat* stats;
-    ActiveClient* clients;
+    ActiveClient** clients;
+    Limits* limits;
+    Bucket trade;
+    Bucket list;
+    Handoff* handoff;
+    Capture* capture;
+    Notices* notices;
+    unsigned long session;
+    char* in;
+    int inOff;
+    int inLen;
+    int inCap;
+    char* out;
+    int outLen;
+    int outCap;
 } ThreadArgs;
 
 // functions
@@ -141,6 +386,32 @@ bool check_digits(const char* number) {
     return true;
 }
 
+/* check_limit()
+* −−−−−−−−−−−−−−−
+* Reads the value of a numeric limit option if argv[i] is that option.
+* 
+* option: The option name.
+* value: Where to store the value; UNSET_LIMIT until it is given.
+* i: The index of the argument being checked.
+* argc: The number of arguments passed in the command line.
+* argv: The array of strings containing the command line arguments.
+*
+* Return: true if argv[i] was the option (and its value was consumed)
+* Errors: if the option is repeated or its value is missing or not a number
+*/
+bool check_limit(const char* option, int* value, int i, int argc, 
+        char* argv[]) {
+    if (strcmp(argv[i], option) != 0) {
+        return false;
+    }
+    if (i + 1 >= argc || *value != UNSET_LIMIT || argv[i + 1][0] == '\0' ||
+            !check_digits(argv[i + 1])) {
+        usage_err();
+    }
+    *value = atoi(argv[i + 1]);
+    return true;
+}
+
 /* check_command_line()
 * −−−−−−−−−−−−−−−
 * Checks the validity of command line arguments 
@@ -149,15 +420,22 @@ bool check_digits(const char* number) {
 * argc: The number of arguments passed in the command line.
 * argv: The array of strings containing the command line arguments.
 * 
-* Errors: if insufficient or too many arguments are given or not a valid port 
-* number is given or port number is not a digit.
+* Errors: if an argument is unknown, repeated or missing its value, or not a
+* valid port number is given or port number is not a digit.
 */
 void check_command_line(AuctionData* data, int argc, char* argv[]) {
     bool setMax = false;
     bool setPort = false;
-    if (argc == MIN_ARGS || argc > MAX_ARGS) {
-        usage_err();
-    }
+    data->useUring = false;
+    data->historyPath = NULL;
+    data->unixPath = NULL;
+    data->capture.path = NULL;
+    Handoff* handoff = &data->handoff;
+    Limits* limits = &data->limits;
+    limits->tradeRate = UNSET_LIMIT;
+    limits->listRate = UNSET_LIMIT;
+    limits->maxInFlight = UNSET_LIMIT;
+    limits->maxBacklog = UNSET_LIMIT;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], LISTEN_ON) == 0 && i + 1 < argc && !setPort &&
@@ -181,11 +459,50 @@ void check_command_line(AuctionData* data, int argc, char* argv[]) {
             data->maxConnections = atoi(argv[i + 1]);
             setMax = true;
             i++;
+        } else if (strcmp(argv[i], URING) == 0 && !data->useUring) {
+            data->useUring = true;
+        } else if (strcmp(argv[i], HISTORY) == 0 && i + 1 < argc && 
+                !data->historyPath && argv[i + 1][0] != '\0') {
+            data->historyPath = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], LISTEN_UNIX) == 0 && i + 1 < argc && 
+                !data->unixPath && argv[i + 1][0] != '\0' &&
+                strlen(argv[i + 1]) < SUN_PATH_LEN) {
+            data->unixPath = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], HANDOFF) == 0 && i + 1 < argc && 
+                !handoff->path && argv[i + 1][0] != '\0' &&
+                strlen(argv[i + 1]) < SUN_PATH_LEN) {
+            handoff->path = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], TAKEOVER) == 0 && i + 1 < argc && 
+                !handoff->takeoverPath && argv[i + 1][0] != '\0' &&
+                strlen(argv[i + 1]) < SUN_PATH_LEN) {
+            handoff->takeoverPath = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], CAPTURE) == 0 && i + 1 < argc && 
+                !data->capture.path && argv[i + 1][0] != '\0') {
+            data->capture.path = argv[i + 1];
+            i++;
+        } else if (check_limit(TRADE_RATE, &limits->tradeRate, i, argc, argv) ||
+                check_limit(LIST_RATE, &limits->listRate, i, argc, argv) ||
+                check_limit(IN_FLIGHT, &limits->maxInFlight, i, argc, argv) ||
+                check_limit(MAX_BACKLOG, &limits->maxBacklog, i, argc, 
+                argv)) {
+            i++;
         } else {
             usage_err();
         }
     }
 
+    int* limitValues[] = {&limits->tradeRate, &limits->listRate, 
+            &limits->maxInFlight, &limits->maxBacklog};
+    for (int i = 0; i < (int)(sizeof(limitValues) / sizeof(int*)); i++) {
+        if (*limitValues[i] == UNSET_LIMIT) {
+            *limitValues[i] = 0;
+        }
+    }
+
     if (!setMax) {
         data->maxConnections = 0;
     }
@@ -195,6 +512,24 @@ void check_command_line(AuctionData* data, int argc, char* argv[]) {
     }
 }
 
+/* report_port()
+* −−−−−−−−−−−−−−−
+* Prints the port number the TCP socket is listening on to stderr
+* 
+* listenfd: The listening socket.
+*/
+void report_port(int listenfd) {
+    struct sockaddr_in sockin;
+    socklen_t len = sizeof(sockin);
+    if (getsockname(listenfd, (struct sockaddr *)&sockin, &len) == -1) {
+        perror("getsockname");
+    } else {
+        // Getting the number of the port
+        fprintf(stderr, "%d\n", ntohs(sockin.sin_port));
+    }
+    fflush(stderr);
+}
+
 /* connect_port()
 * −−−−−−−−−−−−−−−
 * Creates a socket and binds it to a port number specified.
@@ -236,402 +571,3314 @@ void connect_port(AuctionData* data) {
         fprintf(stderr, INVALID_PORT);
         exit(INVALID_PORT_CODE);
     }
+    report_port(listenfd);
+}
 
-    struct sockaddr_in sockin;
-    socklen_t len = sizeof(sockin);
-    if (getsockname(listenfd, (struct sockaddr *)&sockin, &len) == -1) {
-        perror("getsockname");
-    } else {
-        // Getting the number of the port
-        fprintf(stderr, "%d\n", ntohs(sockin.sin_port));
+/* unix_address()
+* −−−−−−−−−−−−−−−
+* Fills in the address of a Unix domain socket. A path starting with '@'
+* names a socket in the abstract namespace.
+* 
+* path: The socket path (shorter than SUN_PATH_LEN).
+* addr: The address to fill in.
+*
+* Return: the length of the address
+*/
+socklen_t unix_address(const char* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int pathLen = strlen(path);
+    memcpy(addr->sun_path, path, pathLen);
+    socklen_t addrLen = offsetof(struct sockaddr_un, sun_path) + pathLen;
+    if (path[0] == '@') {
+        addr->sun_path[0] = '\0';
+        return addrLen;
     }
-    fflush(stderr);
+    return addrLen + 1;
 }
 
-/* check_active()
+/* listen_unix()
 * −−−−−−−−−−−−−−−
-* Checks if a client with the given file descriptor is active.
-* 
-* fd: The file descriptor of the client to check.
-* clients: An array of ActiveClient structs representing all clients.
-* totalCon: The total number of connected clients.
+* Creates a listening Unix domain socket, replacing a stale socket file. 
+* A socket file is only stale if connecting to it is refused.
 * 
-* Return: true if the client is active, false otherwise.
+* path: The socket path.
+*
+* Return: the listening socket, or -1 if it can't be listened on
 */
-bool check_active(int fd, ActiveClient* clients, int totalCon) {
-    for (int i = 0; i < totalCon; i++) {
-        if (clients[i].id == fd) {
-            return clients[i].active;
+int listen_unix(const char* path) {
+    struct sockaddr_un addr;
+    socklen_t addrLen = unix_address(path, &addr);
+    struct stat info;
+    if (path[0] != '@' && lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool stale = probe >= 0 && 
+                connect(probe, (struct sockaddr*)&addr, addrLen) < 0 && 
+                errno == ECONNREFUSED;
+        if (probe >= 0) {
+            close(probe);
         }
+        if (!stale) {
+            return -1;
+        }
+        unlink(path);
     }
-    return false;
+    int listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenfd < 0 || bind(listenfd, (struct sockaddr*)&addr, addrLen) < 0 ||
+            listen(listenfd, SOMAXCONN) < 0) {
+        if (listenfd >= 0) {
+            close(listenfd);
+        }
+        return -1;
+    }
+    return listenfd;
 }
 
-/* process_sell()
+/* connect_unix()
 * −−−−−−−−−−−−−−−
-* Processes a sell request and adds item if it meets the requirements.
+* Creates the Unix domain socket given by --listen-unix, if any, and listens
+* on it alongside the TCP socket. A path starting with '@' names a socket in
+* the abstract namespace; otherwise a stale socket file is replaced.
 * 
-* line: The client input line
-* params: The ThreadArgs struct
-* numArgs: The number of arguments in the sell request.
-* fields: The array of fields in the sell request.
-* curFd: The file descriptor of the client making the request.
-* response: The response message to be sent back to the client.
+* data: A pointer to the AuctionData struct
 * 
-* Return: a response message whether the sell request was valid or not
+* Errors: if the socket cant be listened on
 */
-char* process_sell(char* line, ThreadArgs* params, int numArgs, char** fields, 
-        int curFd, char* response) {
-    params->stats->sellRequest++;
-    if (numArgs == SELL_ARGS_NO) {
-        Auction* auction = params->auction;
-        if (check_digits(fields[RESERVE]) && check_digits(fields[DURATION])) {
-            for (int i = 0; i < auction->numItems; i++) {
-                if (!auction->items[i].removed && 
-                        strcmp(auction->items[i].itemName, 
-                        fields[SELL_NAME]) == 0) {
-                    return REJECTED; 
-                }
-            }
-            int reserve = atoi(fields[RESERVE]);
-            double duration = atoi(fields[DURATION]) + get_time_ms();
-            int charLen = strlen(line) - 1; //-4 sell +3 for space0|
-            if (reserve > 0 && atoi(fields[DURATION]) >= 1) {
-                params->stats->sellAccepted++;
-                Item item = {.owner = curFd, .highestBidder = 0, 
-                    .duration = duration, .removed = false, 
-                    .itemName = strdup(fields[SELL_NAME]), .highestBid = 0,
-                    .reserve = reserve, .charLen = charLen,
-                    .reserveLen = strlen(fields[RESERVE])};
-                response = malloc(strlen(item.itemName) + BUFFER_LISTED);
-                sprintf(response, LISTED, item.itemName);
-                auction->items = realloc(auction->
-                        items, (auction->numItems + 1) *
-                        sizeof(Item));
-                auction->items[auction->numItems] = item;
-                auction->numItems++;
-                return response;
-            } else {
-                return INVALID;
-            }
-        } else {
-            return INVALID;
-        }
-    } else {
-        return INVALID;
+void connect_unix(AuctionData* data) {
+    data->fdUnix = -1;
+    if (!data->unixPath) {
+        return;
+    }
+    data->fdUnix = listen_unix(data->unixPath);
+    if (data->fdUnix < 0) {
+        fprintf(stderr, INVALID_UNIX);
+        exit(INVALID_PORT_CODE);
     }
 }
 
-/* process_bid()
+/* active_fd()
 * −−−−−−−−−−−−−−−
-* Processes a bid request
+* Looks up the connection of a client that is still active. Caller holds 
+* the auction lock.
 * 
-* line: The client input line
-* params: The ThreadArgs struct
-* numArgs: The number of arguments in the sell request.
-* fields: The array of fields in the sell request.
-* curFd: The file descriptor of the client making the request.
-* response: The response message to be sent back to the client.
+* client: The id of the client, 0 for none or GONE_CLIENT.
+* clients: An array of ActiveClient structs representing all clients.
+* totalCon: The total number of connected clients.
 * 
-* Return: a response message whether the sell request was valid or not
+* Return: the client's file descriptor, or -1 if it is not active.
 */
-char* process_bid(char* line, ThreadArgs* params, int numArgs, char** fields, 
-        int curFd, char* response) {
-    params->stats->bidReceived++;
-    if (numArgs == BID_ARGS) {
-        if (!check_digits(fields[BID_ARGS_NO])) {
-            return INVALID;
-        }
-        int bid = atoi(fields[BID_ARGS_NO]);
-        if (bid < 1) {
-            return INVALID;
-        }
-        for (int i = 0; i < params->auction->numItems; i++) {
-            Item* item = &(params->auction->items[i]);
-            if (strcmp(item->itemName, fields[BID_NAME_ARGS_NO]) == 0 &&
-                    !item->removed) {
-
-                if (bid >= item->reserve && item->owner != curFd && 
-                        item->highestBidder != curFd && 
-                        bid > item->highestBid) {
-                    if (item->highestBidder != 0 && check_active(item->
-                            highestBidder, params->clients, *params->
-                            totalCon)) {
-                        char* outBid = malloc(strlen(item->
-                                itemName) + BUFFER_LISTED);
-                        sprintf(outBid, ":outbid %s %d", item->
-                                itemName, bid);
-                        FILE* to = fdopen(item->highestBidder, "w");
-                        fprintf(to, "%s\n", outBid);
-                        fflush(to);
-                    }
-                    params->stats->bidAccepted++;
-                    item->highestBid = bid;
-                    item->highestBidder = curFd;
-                    item->charLen = item->charLen + strlen(fields[2]) -
-                            item->reserveLen;
-                    response = malloc(strlen(fields[BID_NAME_ARGS_NO]) +
-                            NAME_BUFFER);
-                    sprintf(response, ":bid %s", fields[BID_NAME_ARGS_NO]);
-                    return response;
-                } else {
-                    return REJECTED;
-                }
-            } 
-        }
-        return REJECTED;
-    } else {
-        return INVALID;
+int active_fd(int client, ActiveClient* clients, int totalCon) {
+    if (client <= 0 || client > totalCon || !clients[client - 1].active) {
+        return -1;
     }
+    return clients[client - 1].fd;
 }
 
-/* make_list()
+/* hash_name()
 * −−−−−−−−−−−−−−−
-* Iterates through the auction's items and creates a list of live items 
-* 
-* param: The ThreadArgs struct
-* response: The string to store the list of items.
-* responseLen: The maximum length of the response string.
+* FNV-1a hash of an item name.
+*
+* name: The item name to hash.
+*
+* Returns: the hash value
 */
-void make_list(ThreadArgs* params, char* response, int responseLen) {
-    for (int i = 0; i < params->auction->numItems; i++) {
-        Item* item = &(params->auction->items[i]);
-        if (item->removed) {
-            continue;
-        } 
-        strcat(response, item->itemName);
-        strcat(response, SPACE);
-        char reserveStr[responseLen]; //Max length
-        snprintf(reserveStr, sizeof(reserveStr), "%d", item->reserve);
-        strcat(response, reserveStr);
-        strcat(response, SPACE);
-        char maxBidStr[responseLen];  
-        snprintf(maxBidStr, sizeof(maxBidStr), "%d", item->highestBid);
-        strcat(response, maxBidStr);
-        strcat(response, SPACE);
-        char remainStr[responseLen];  
-        double remainTime = (item->duration - get_time_ms());
-        if (remainTime < 1) {
-            remainTime = 0;
-        }
-        snprintf(remainStr, sizeof(remainStr), "%d", (int)remainTime);
-        strcat(response, remainStr);
-        strcat(response, BREAKER);
+unsigned int hash_name(const char* name) {
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+        name++;
     }
+    return hash;
 }
 
-/* process_line()
+/* set_name()
 * −−−−−−−−−−−−−−−
-* Processes a line of input from a client and returns a response.
-* 
-* line: The line of input to process.
-* params: The ThreadArgs struct.
-* curFd: The file descriptor of the current client.
+* Stores a name, inline when it fits.
 *
-* Return A response to the client's input.
+* itemName: The ItemName to fill in.
+* name: The name to store.
 */
-char* process_line(char* line, ThreadArgs* params, int curFd) {
-    char** fields = split_by_char(line, BLANK, 0);
-    int numArgs = 0;
-    while (fields[numArgs] != NULL) {
-            numArgs++;
-        }
-    char* command = fields[0];
-    char* response = NULL;
-    if (numArgs > MAX_INPUT) {
-        return INVALID;
+void set_name(ItemName* itemName, const char* name) {
+    if (strlen(name) < NAME_INLINE) {
+        strcpy(itemName->inlineName, name);
+        itemName->longName = NULL;
     } else {
-        if (strcmp(command, "sell") == 0) {
-            pthread_mutex_lock(&params->auction->lock);
-            response = process_sell(line, params, numArgs, fields, curFd, 
-                    response);
-            pthread_mutex_unlock(&params->auction->lock);
-        } else if (strcmp(command, "bid") == 0) {
-            pthread_mutex_lock(&params->auction->lock);
-            response = process_bid(line, params, numArgs, fields, curFd, 
-                    response);
-            pthread_mutex_unlock(&params->auction->lock);
-        } else if (strcmp(command, "list") == 0 && numArgs == 1) {
-            bool allRemoved = true;
-            response = ":list";
-            pthread_mutex_lock(&params->auction->lock);
-            if (params->auction->numItems == 0) {
-                pthread_mutex_unlock(&params->auction->lock);
-                return response;
-            }
-            int responseLen = BUFFER_LEN;  // For ":list"
-            for (int i = 0; i < params->auction->numItems; i++) {
-                responseLen += params->auction->items[i].charLen;
-                if (!params->auction->items[i].removed) {
-                    allRemoved = false;
-                }
-            }
-            pthread_mutex_unlock(&params->auction->lock);
-            if (allRemoved) {
-                return response;
-            }
-            char* response = (char*)malloc(responseLen * sizeof(char));
-            strcpy(response, ":list ");
-            make_list(params, response, responseLen);
-            return response;
-        } else {
-            return INVALID;
-        }
+        itemName->longName = strdup(name);
     }
-    return response;
 }
 
-/* expiry_thread()
+/* get_name()
 * −−−−−−−−−−−−−−−
-* Thread that checks when auctoins expire
-* If expired, removes item from auction and notifies highest bidder and owner 
-* If no bids, it notifies only the owner.
-* 
-* arg: a pointer to the AuctionData struct 
-* 
-* Return NULL
+* Returns the name held by an ItemName.
+*
+* itemName: The ItemName.
 */
-void* expiry_thread(void* arg) {
-    AuctionData* data = (AuctionData*)arg;
-    while (1) {
-        pthread_mutex_lock(&data->auction->lock);
-        double currentTime = get_time_ms();
-        for (int i = 0; i < data->auction->numItems; i++) {
-            Item* item = &data->auction->items[i];
-            if (!item->removed && currentTime >= item->duration) {
-                item->removed = true;
-                if (item->highestBidder != 0) {
-                    if (check_active(item->owner, data->clients,
-                            data->totalCon)) {
-                        char* sold = malloc(item->charLen + NAME_BUFFER);
-                        sprintf(sold, ":sold %s %d", item->itemName, 
-                                item->highestBid);
-                        FILE* to = fdopen(item->owner, "w");
-                        fprintf(to, "%s\n", sold);
-                        fflush(to);
-                    }
-                    if (check_active(item->highestBidder, data->clients, 
-                            data->totalCon)) {
-                        char* won = malloc(item->charLen + BUFFER_LEN);
-                        sprintf(won, ":won %s %d", item->itemName, 
-                                item->highestBid);
-                        FILE* to2 = fdopen(item->highestBidder, "w");
-                        fprintf(to2, "%s\n", won);
-                        fflush(to2);
-                    }
-                    
-                } else {
-                    if (check_active(item->owner, data->clients, 
-                            data->totalCon)) {
-                        char* unsold = malloc(strlen(item->itemName) + 
-                                BUFFER_LARGE);
-                        sprintf(unsold, ":unsold %s", item->itemName);
-                        FILE* to = fdopen(item->owner, "w");
-                        fprintf(to, "%s\n", unsold);
-                        fflush(to);
-                    }
-                }
-            }
-        }
-        pthread_mutex_unlock(&data->auction->lock);
-        usleep(100000); //100ms
-    }
+const char* get_name(const ItemName* itemName) {
+    return itemName->longName ? itemName->longName : itemName->inlineName;
+}
 
-    return NULL;
+/* item_name()
+* −−−−−−−−−−−−−−−
+* Returns the name of an item.
+*
+* auction: The Auction struct.
+* index: The index of the item.
+*/
+const char* item_name(Auction* auction, int index) {
+    return get_name(&auction->info[index].name);
 }
 
-/* client_thread()
+/* name_slot()
 * −−−−−−−−−−−−−−−
-* Thread that handles communication with a client.
-* Reads input from client and processes it.
-* 
-* arg: A void pointer to a ThreadArgs struct 
-* 
-* Return NULL
+* Probes the name index for a name. The index must not be empty.
+*
+* auction: The Auction struct.
+* name: The item name.
+* hash: The hash of the name.
+*
+* Returns: the slot holding the item, or the empty slot where it would go
 */
-void* client_thread(void* arg) {
-    ThreadArgs* params = (ThreadArgs*)arg;
-    int fd = params->fdptr;
-    FILE* to = fdopen(fd, "w");
-    FILE* from = fdopen(dup(fd), "r");
-    char* currentIn;
-    while ((currentIn = read_line(from)) != NULL) {
-        char* response;
-        response = process_line(currentIn, params, fd);
-        fprintf(to, "%s\n", response);
-        fflush(to);
-        free(currentIn);
-    }
-    pthread_mutex_lock(params->lock);
-    for (int i = 0; i < *params->curCon; i++) {
-        if (params->clients[i].id == fd) {
-            params->clients[i].active = false;
+int name_slot(Auction* auction, const char* name, unsigned int hash) {
+    int mask = auction->slotsSize - 1;
+    for (int pos = hash & mask; ; pos = (pos + 1) & mask) {
+        int item = auction->slots[pos] - 1;
+        if (item < 0 || (auction->nameHash[item] == hash &&
+                strcmp(item_name(auction, item), name) == 0)) {
+            return pos;
         }
     }
-    (*params->curCon)--;
-    pthread_mutex_unlock(params->lock);
-
-    close(fd);
-    fclose(to);
-    fclose(from);
-
-    return NULL;
 }
 
-/* client_thread()
+/* find_item()
 * −−−−−−−−−−−−−−−
-* Processes incoming connections from clients and creates a new thread to
-* handle each client.
-* If max connections is set, it will wait in a while loop until a client 
-* disconnects before accepting a new connection.
-* 
-* data: A pointer to the AuctionData struct
+* Finds the open item with the given name through the name index.
 *
-* Errors: if the socket cant be accepted
+* auction: The Auction struct.
+* name: The item name.
+*
+* Returns: the index of the item, or -1 if there is no such open item
 */
-void process_connections(AuctionData* data) {
-    int fd;
-    struct sockaddr_in fromAddr;
-    socklen_t fromAddrSize;
-
-    int maxCon = data->maxConnections;
+int find_item(Auction* auction, const char* name) {
+    if (auction->slotsSize == 0) {
+        return -1;
+    }
+    return auction->slots[name_slot(auction, name, hash_name(name))] - 1;
+}
 
-    while (1) {
-        fromAddrSize = sizeof(struct sockaddr_in);
-        fd = accept(data->fdServer, (struct sockaddr*)&fromAddr, 
-                &fromAddrSize);
-        data->fdptr = fd;
-        if (fd < 0) {
-            perror("Error accepting connection");
-            exit(1);
-        }
-        pthread_mutex_lock(&data->lock);
-        if (maxCon != 0) {
-            while (data->numCon >= maxCon) {
-                pthread_mutex_unlock(&data->lock);
-                pthread_mutex_lock(&data->lock);
-            }
+/* index_rebuild()
+* −−−−−−−−−−−−−−−
+* Resizes the name index to twice the item capacity and reinserts every
+* open item.
+*
+* auction: The Auction struct.
+*/
+void index_rebuild(Auction* auction) {
+    free(auction->slots);
+    auction->slotsSize = auction->capacity * 2;
+    auction->slots = calloc(auction->slotsSize, sizeof(int));
+    int mask = auction->slotsSize - 1;
+    for (int i = 0; i < auction->numItems; i++) {
+        int pos = auction->nameHash[i] & mask;
+        while (auction->slots[pos] != 0) {
+            pos = (pos + 1) & mask;
         }
-        data->clients = realloc(data->clients, (data->totalCon + 1) * 
-                sizeof(ActiveClient));
-        data->clients[data->totalCon].id = fd;
-        data->clients[data->totalCon].active = true;
-        (data->numCon)++;
-        (data->totalCon)++;
-        
-        pthread_mutex_unlock(&data->lock);
-        ThreadArgs threadArgs = {.fdptr = fd, .curCon = &data->numCon, 
-                .lock = &data->lock, .auction = data->auction, 
-                .stats = data->stats, .clients = data->clients,
-                .totalCon = &data->totalCon};
-
-        pthread_t threadId;
-        pthread_create(&threadId, NULL, client_thread, &threadArgs);
-        pthread_detach(threadId);
-
+        auction->slots[pos] = i + 1;
     }
 }
 
+/* index_delete()
+* −−−−−−−−−−−−−−−
+* Empties a slot of the name index, shifting later entries of the probe run
+* back so that no lookup stops early.
+*
+* auction: The Auction struct.
+* pos: The slot to empty.
+*/
+void index_delete(Auction* auction, int pos) {
+    int mask = auction->slotsSize - 1;
+    int hole = pos;
+    for (int next = (pos + 1) & mask; auction->slots[next] != 0; 
+            next = (next + 1) & mask) {
+        int home = auction->nameHash[auction->slots[next] - 1] & mask;
+        // Entries whose home lies cyclically after the hole must stay put
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            auction->slots[hole] = auction->slots[next];
+            hole = next;
+        }
+    }
+    auction->slots[hole] = 0;
+}
+
+/* record_change()
+* −−−−−−−−−−−−−−−
+* Bumps the auction's version and records the changed item in the journal,
+* overwriting the oldest entry. Caller holds the auction lock.
+*
+* auction: The Auction struct.
+* name: The name of the item that changed.
+*/
+void record_change(Auction* auction, const char* name) {
+    auction->version++;
+    Change* change = &auction->journal[auction->version % JOURNAL_SIZE];
+    int nameLen = strlen(name);
+    if (nameLen >= change->nameCap) {
+        change->nameCap = nameLen + NAME_INLINE;
+        change->name = realloc(change->name, change->nameCap);
+    }
+    memcpy(change->name, name, nameLen + 1);
+    change->version = auction->version;
+}
+
+/* add_item()
+* −−−−−−−−−−−−−−−
+* Appends an open item to the auction, growing every array together.
+*
+* auction: The Auction struct.
+* name: The item name.
+* info: The item's cold fields (name is filled in here).
+* expiry: The time the auction closes.
+* listLen: Upper bound on the item's length in a list response.
+*/
+void add_item(Auction* auction, const char* name, ItemInfo info, 
+        double expiry, int listLen) {
+    if (auction->numItems == auction->capacity) {
+        auction->capacity = auction->capacity ? auction->capacity * 2 : 
+                MIN_ITEMS;
+        int cap = auction->capacity;
+        auction->expiry = realloc(auction->expiry, cap * sizeof(double));
+        auction->highestBid = realloc(auction->highestBid, cap * sizeof(int));
+        auction->listLen = realloc(auction->listLen, cap * sizeof(int));
+        auction->nameHash = realloc(auction->nameHash, cap * 
+                sizeof(unsigned int));
+        auction->info = realloc(auction->info, cap * sizeof(ItemInfo));
+        index_rebuild(auction);
+    }
+    int i = auction->numItems;
+    set_name(&info.name, name);
+    auction->info[i] = info;
+    auction->expiry[i] = expiry;
+    auction->highestBid[i] = 0;
+    auction->listLen[i] = listLen;
+    auction->nameHash[i] = hash_name(name);
+    auction->slots[name_slot(auction, name, auction->nameHash[i])] = i + 1;
+    auction->numItems++;
+    record_change(auction, name);
+}
+
+/* remove_item()
+* −−−−−−−−−−−−−−−
+* Removes a closed item from the name index and leaves a gap in its place,
+* to be closed up by compact_items() before the auction lock is released.
+*
+* auction: The Auction struct.
+* i: The index of the item.
+*/
+void remove_item(Auction* auction, int i) {
+    index_delete(auction, name_slot(auction, item_name(auction, i), 
+            auction->nameHash[i]));
+    free(auction->info[i].name.longName);
+    auction->expiry[i] = CLOSED_EXPIRY;
+    auction->numClosed++;
+}
+
+/* compact_items()
+* −−−−−−−−−−−−−−−
+* Closes up the gaps left by remove_item() in one pass, keeping the open 
+* items in the order they were listed, and re-points the name index slots
+* of the items that move. Caller holds the auction lock.
+*
+* auction: The Auction struct.
+*/
+void compact_items(Auction* auction) {
+    if (auction->numClosed == 0) {
+        return;
+    }
+    int mask = auction->slotsSize - 1;
+    int kept = 0;
+    for (int i = 0; i < auction->numItems; i++) {
+        if (auction->expiry[i] == CLOSED_EXPIRY) {
+            continue;
+        }
+        if (kept != i) {
+            // Slots still hold old indices from i on, new ones below it
+            int pos = auction->nameHash[i] & mask;
+            while (auction->slots[pos] != i + 1) {
+                pos = (pos + 1) & mask;
+            }
+            auction->slots[pos] = kept + 1;
+            auction->expiry[kept] = auction->expiry[i];
+            auction->highestBid[kept] = auction->highestBid[i];
+            auction->listLen[kept] = auction->listLen[i];
+            auction->nameHash[kept] = auction->nameHash[i];
+            auction->info[kept] = auction->info[i];
+        }
+        kept++;
+    }
+    auction->numItems = kept;
+    auction->numClosed = 0;
+}
+
+/* list_length()
+* −−−−−−−−−−−−−−−
+* Upper bound on the length of the entries of a list response. Caller holds 
+* the auction lock.
+*
+* auction: The Auction struct.
+*
+* Returns: the summed entry lengths of open items
+*/
+int list_length(Auction* auction) {
+    int length = 0;
+    for (int i = 0; i < auction->numItems; i++) {
+        length += auction->listLen[i];
+    }
+    return length;
+}
+
+/* clock_init()
+* −−−−−−−−−−−−−−−
+* Starts the auction clock.
+*
+* auction: The Auction struct.
+*/
+void clock_init(Auction* auction) {
+#ifdef VIRTUAL_CLOCK
+    auction->clock.now = get_time_ms();
+    auction->clock.swept = auction->clock.now;
+    pthread_cond_init(&auction->clock.advanced, NULL);
+#else
+    (void)auction;
+#endif
+}
+
+/* clock_now()
+* −−−−−−−−−−−−−−−
+* The time auction deadlines are measured against: the monotonic clock, or 
+* the virtual clock in builds with VIRTUAL_CLOCK. Caller holds the auction 
+* lock.
+*
+* auction: The Auction struct.
+*
+* Returns: the time in seconds
+*/
+double clock_now(Auction* auction) {
+#ifdef VIRTUAL_CLOCK
+    return auction->clock.now;
+#else
+    (void)auction;
+    return get_time_ms();
+#endif
+}
+
+/* clock_sleep()
+* −−−−−−−−−−−−−−−
+* Releases the auction lock and waits until the next expiry sweep is due. 
+* With the virtual clock, first records that the sweep at time swept is 
+* done, and wakes early when the clock is advanced.
+*
+* auction: The Auction struct (locked by the caller).
+* swept: The time the sweep just finished used.
+*/
+void clock_sleep(Auction* auction, double swept) {
+#ifdef VIRTUAL_CLOCK
+    auction->clock.swept = swept;
+    pthread_cond_broadcast(&auction->clock.advanced);
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += EXPIRY_INTERVAL_US * 1000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&auction->clock.advanced, &auction->lock, &until);
+    pthread_mutex_unlock(&auction->lock);
+#else
+    (void)swept;
+    pthread_mutex_unlock(&auction->lock);
+    usleep(EXPIRY_INTERVAL_US);
+#endif
+}
+
+/* put_varint()
+* −−−−−−−−−−−−−−−
+* Writes an unsigned LEB128 varint.
+*
+* buf: Where to write (at least VARINT_MAX bytes).
+* value: The value to write.
+*
+* Returns: the number of bytes written
+*/
+int put_varint(unsigned char* buf, unsigned long value) {
+    int n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[n++] = value;
+    return n;
+}
+
+/* get_varint()
+* −−−−−−−−−−−−−−−
+* Reads an unsigned LEB128 varint and advances past it.
+*
+* buf: Pointer to the read position.
+*
+* Returns: the value read
+*/
+unsigned long get_varint(const unsigned char** buf) {
+    unsigned long value = 0;
+    int shift = 0;
+    while (**buf & 0x80) {
+        value |= (unsigned long)(**buf & 0x7f) << shift;
+        shift += 7;
+        (*buf)++;
+    }
+    value |= (unsigned long)**buf << shift;
+    (*buf)++;
+    return value;
+}
+
+/* history_record()
+* −−−−−−−−−−−−−−−
+* Decodes the history record at an offset.
+*
+* history: The History store.
+* offset: The offset of the record.
+* back: Set to the distance back to the previous record for the name, or 0.
+* reserve: Set to the item's reserve.
+* price: Set to the winning bid, or 0 if unsold.
+* nameLen: Set to the length of the name.
+*
+* Returns: pointer to the (not null terminated) name
+*/
+const char* history_record(History* history, long offset, long* back, 
+        int* reserve, int* price, int* nameLen) {
+    const unsigned char* pos = (unsigned char*)history->base + offset;
+    *back = get_varint(&pos);
+    *reserve = get_varint(&pos);
+    *price = get_varint(&pos);
+    *nameLen = get_varint(&pos);
+    return (const char*)pos;
+}
+
+/* history_slot()
+* −−−−−−−−−−−−−−−
+* Finds the index slot for a name, or the empty slot where it would go.
+*
+* history: The History store.
+* name: The item name.
+*
+* Returns: pointer to the slot
+*/
+long* history_slot(History* history, const char* name) {
+    int len = strlen(name);
+    unsigned int i = hash_name(name) & (history->indexSize - 1);
+    while (history->index[i] != -1) {
+        long back;
+        int reserve, price, nameLen;
+        const char* recordName = history_record(history, history->index[i],
+                &back, &reserve, &price, &nameLen);
+        if (nameLen == len && memcmp(recordName, name, len) == 0) {
+            break;
+        }
+        i = (i + 1) & (history->indexSize - 1);
+    }
+    return &history->index[i];
+}
+
+/* history_index()
+* −−−−−−−−−−−−−−−
+* Makes a record the latest one for its name in the index, growing the 
+* index when it gets too full.
+*
+* history: The History store.
+* offset: The offset of the record.
+*/
+void history_index(History* history, long offset) {
+    if ((history->numNames + 1) * 4 > history->indexSize * 3) {
+        long* old = history->index;
+        int oldSize = history->indexSize;
+        history->indexSize = oldSize * 2;
+        history->index = malloc(history->indexSize * sizeof(long));
+        memset(history->index, -1, history->indexSize * sizeof(long));
+        history->numNames = 0;
+        for (int i = 0; i < oldSize; i++) {
+            if (old[i] != -1) {
+                history_index(history, old[i]);
+            }
+        }
+        free(old);
+    }
+    long back;
+    int reserve, price, nameLen;
+    const char* name = history_record(history, offset, &back, &reserve, 
+            &price, &nameLen);
+    // Names are unbounded, so only short ones are copied on the stack
+    char buffer[NOTICE_BUFFER];
+    char* key = nameLen < NOTICE_BUFFER ? buffer : malloc(nameLen + 1);
+    memcpy(key, name, nameLen);
+    key[nameLen] = '\0';
+    long* slot = history_slot(history, key);
+    if (*slot == -1) {
+        history->numNames++;
+    }
+    *slot = offset;
+    if (key != buffer) {
+        free(key);
+    }
+}
+
+/* history_grow()
+* −−−−−−−−−−−−−−−
+* Makes room for at least extra more bytes in the log. A file-backed log is
+* extended and mapped again; otherwise the log is reallocated.
+*
+* history: The History store.
+* extra: The number of bytes needed.
+*
+* Errors: if the history file can't be extended
+*/
+void history_grow(History* history, long extra) {
+    if (history->len + extra <= history->cap) {
+        return;
+    }
+    long cap = history->cap;
+    while (history->len + extra > cap) {
+        cap *= 2;
+    }
+    if (history->fd == -1) {
+        history->base = realloc(history->base, cap);
+    } else {
+        munmap(history->base, history->cap);
+        history->base = MAP_FAILED;
+        if (ftruncate(history->fd, cap) == 0) {
+            history->base = mmap(NULL, cap, PROT_READ | PROT_WRITE, 
+                    MAP_SHARED, history->fd, 0);
+        }
+        if (history->base == MAP_FAILED) {
+            fprintf(stderr, HISTORY_ERR);
+            exit(HISTORY_ERR_CODE);
+        }
+    }
+    history->cap = cap;
+}
+
+/* history_index_from()
+* −−−−−−−−−−−−−−−
+* Indexes every record from an offset to the end of the log.
+*
+* history: The History store.
+* offset: The offset of the first record to index.
+*/
+void history_index_from(History* history, long offset) {
+    while (offset < history->len) {
+        long back;
+        int reserve, price, nameLen;
+        const char* name = history_record(history, offset, &back, &reserve,
+                &price, &nameLen);
+        history_index(history, offset);
+        offset = name + nameLen - history->base;
+    }
+}
+
+/* history_open()
+* −−−−−−−−−−−−−−−
+* Sets up the history store, in memory or mapped from a file. Records 
+* already in the file are indexed so their results stay available.
+*
+* history: The History store.
+* path: The history file, or NULL to keep history in memory.
+*
+* Errors: if the history file can't be opened or mapped
+*/
+void history_open(History* history, const char* path) {
+    history->fd = -1;
+    history->cap = HISTORY_MIN_SIZE;
+    history->len = HISTORY_HEADER;
+    history->indexSize = HISTORY_MIN_INDEX;
+    history->index = malloc(history->indexSize * sizeof(long));
+    memset(history->index, -1, history->indexSize * sizeof(long));
+    history->numNames = 0;
+    if (path == NULL) {
+        history->base = malloc(history->cap);
+        memcpy(history->base, &history->len, HISTORY_HEADER);
+        return;
+    }
+    history->fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat info;
+    if (history->fd == -1 || fstat(history->fd, &info) == -1) {
+        fprintf(stderr, HISTORY_ERR);
+        exit(HISTORY_ERR_CODE);
+    }
+    if (info.st_size > history->cap) {
+        history->cap = info.st_size;
+    }
+    history->base = MAP_FAILED;
+    if (ftruncate(history->fd, history->cap) == 0) {
+        history->base = mmap(NULL, history->cap, PROT_READ | PROT_WRITE, 
+                MAP_SHARED, history->fd, 0);
+    }
+    if (history->base == MAP_FAILED) {
+        fprintf(stderr, HISTORY_ERR);
+        exit(HISTORY_ERR_CODE);
+    }
+    long len;
+    memcpy(&len, history->base, HISTORY_HEADER);
+    if (len < (long)HISTORY_HEADER || len > history->cap) {
+        len = HISTORY_HEADER;
+    }
+    history->len = len;
+    memcpy(history->base, &history->len, HISTORY_HEADER);
+    history_index_from(history, HISTORY_HEADER);
+}
+
+/* history_load()
+* −−−−−−−−−−−−−−−
+* Appends raw records taken from another history store and indexes them.
+* The records' back links stay valid as long as they are loaded into an
+* empty store.
+*
+* history: The History store.
+* records: The records.
+* len: The length of the records in bytes.
+*/
+void history_load(History* history, const char* records, long len) {
+    history_grow(history, len);
+    long offset = history->len;
+    memcpy(history->base + offset, records, len);
+    history->len += len;
+    memcpy(history->base, &history->len, HISTORY_HEADER);
+    history_index_from(history, offset);
+}
+
+/* history_append()
+* −−−−−−−−−−−−−−−
+* Appends the result of a closed auction to the history store.
+*
+* history: The History store.
+* name: The item name.
+* reserve: The item's reserve.
+* price: The winning bid, or 0 if unsold.
+*/
+void history_append(History* history, const char* name, int reserve, 
+        int price) {
+    int nameLen = strlen(name);
+    history_grow(history, 4 * VARINT_MAX + nameLen);
+    long offset = history->len;
+    long* slot = history_slot(history, name);
+    long back = *slot == -1 ? 0 : offset - *slot;
+    unsigned char* pos = (unsigned char*)history->base + offset;
+    pos += put_varint(pos, back);
+    pos += put_varint(pos, reserve);
+    pos += put_varint(pos, price);
+    pos += put_varint(pos, nameLen);
+    memcpy(pos, name, nameLen);
+    history->len = (char*)pos + nameLen - history->base;
+    memcpy(history->base, &history->len, HISTORY_HEADER);
+    history_index(history, offset);
+}
+
+/* capture_open()
+* −−−−−−−−−−−−−−−
+* Opens the capture trace for appending, if one was asked for, and writes
+* the trace header to a new file. Session ids start from the process id so
+* a server taking over the same trace does not reuse them.
+* 
+* capture: The Capture struct.
+*
+* Errors: if the trace can't be opened
+*/
+void capture_open(Capture* capture) {
+    capture->fd = -1;
+    capture->nextSession = (unsigned long)getpid() << 32;
+    if (capture->path == NULL) {
+        return;
+    }
+    capture->fd = open(capture->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    struct stat info;
+    if (capture->fd == -1 || fstat(capture->fd, &info) == -1 || 
+            (info.st_size == 0 && write(capture->fd, CAPTURE_MAGIC, 
+            CAPTURE_MAGIC_LEN) != CAPTURE_MAGIC_LEN)) {
+        fprintf(stderr, CAPTURE_ERR);
+        exit(CAPTURE_ERR_CODE);
+    }
+}
+
+/* capture_flush()
+* −−−−−−−−−−−−−−−
+* Appends this thread's buffered capture records to the trace in one write.
+* 
+* capture: The Capture struct.
+*/
+void capture_flush(Capture* capture) {
+    if (captureBuf.len > 0 && 
+            write(capture->fd, captureBuf.buf, captureBuf.len) == -1) {
+        perror("Error writing capture");
+    }
+    captureBuf.len = 0;
+}
+
+/* capture_record()
+* −−−−−−−−−−−−−−−
+* Buffers a capture record for a request line, or for the end of a session
+* when line is NULL. The buffer is flushed once it is full or its oldest 
+* record has waited CAPTURE_FLUSH_US, at the end of a session, and before 
+* the thread waits for more input.
+* 
+* params: The ThreadArgs of the connection.
+* line: The request line, or NULL.
+*/
+void capture_record(ThreadArgs* params, const char* line) {
+    Capture* capture = params->capture;
+    if (capture->fd == -1) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long micros = now.tv_sec * 1000000L + now.tv_nsec / 1000;
+    int lineLen = line ? strlen(line) : 0;
+    if (captureBuf.len + lineLen + 3 * VARINT_MAX > captureBuf.cap) {
+        captureBuf.cap = captureBuf.len + lineLen + 3 * VARINT_MAX + 
+                CAPTURE_FLUSH_SIZE;
+        captureBuf.buf = realloc(captureBuf.buf, captureBuf.cap);
+    }
+    if (captureBuf.len == 0) {
+        captureBuf.oldest = micros;
+    }
+    unsigned char* end = (unsigned char*)captureBuf.buf + captureBuf.len;
+    end += put_varint(end, micros);
+    end += put_varint(end, params->session);
+    end += put_varint(end, line ? lineLen + 1 : 0);
+    if (line != NULL) {
+        memcpy(end, line, lineLen);
+    }
+    captureBuf.len = (char*)end + lineLen - captureBuf.buf;
+    if (line == NULL || captureBuf.len >= CAPTURE_FLUSH_SIZE || 
+            micros - captureBuf.oldest >= CAPTURE_FLUSH_US) {
+        capture_flush(capture);
+    }
+}
+
+/* client_backlogged()
+* −−−−−−−−−−−−−−−
+* Checks how much output is waiting to be read by a client and disconnects
+* it if that exceeds --maxbacklog. The limit should be below the socket send
+* buffer size so a slow client is dropped before writes to it would block.
+* 
+* fd: The file descriptor of the client.
+* pending: Output queued for the client that is not yet in the socket.
+* maxBacklog: The limit in bytes, or 0 for no limit.
+*
+* Return: true if the client was disconnected
+*/
+bool client_backlogged(int fd, int pending, int maxBacklog) {
+    if (maxBacklog == 0) {
+        return false;
+    }
+    int unsent = 0;
+    ioctl(fd, SIOCOUTQ, &unsent);
+    if (pending + unsent <= maxBacklog) {
+        return false;
+    }
+    shutdown(fd, SHUT_RDWR);
+    return true;
+}
+
+/* take_token()
+* −−−−−−−−−−−−−−−
+* Refills a token bucket for the time since it was last used and takes one
+* token from it.
+* 
+* bucket: The bucket.
+* rate: Tokens added per second, or 0 for no limit.
+*
+* Return: false if the bucket is empty
+*/
+bool take_token(Bucket* bucket, int rate) {
+    if (rate == 0) {
+        return true;
+    }
+    double now = get_time_ms();
+    bucket->tokens += (now - bucket->last) * rate;
+    if (bucket->tokens > rate) {
+        bucket->tokens = rate;
+    }
+    bucket->last = now;
+    if (bucket->tokens < 1) {
+        return false;
+    }
+    bucket->tokens--;
+    return true;
+}
+
+/* admit_request()
+* −−−−−−−−−−−−−−−
+* Applies the per-connection rate limit for the request's command class 
+* and the global limit on requests being processed at once.
+* 
+* line: The request line.
+* params: The ThreadArgs struct.
+*
+* Return: true if the request may be processed; the caller must then call
+* finish_request() once it is done
+*/
+bool admit_request(const char* line, ThreadArgs* params) {
+    Limits* limits = params->limits;
+    int wordLen = strcspn(line, SPACE);
+    if ((wordLen == strlen("list") && strncmp(line, "list", wordLen) == 0) ||
+            (wordLen == strlen("history") && 
+            strncmp(line, "history", wordLen) == 0)) {
+        if (!take_token(&params->list, limits->listRate)) {
+            return false;
+        }
+    } else if ((wordLen == strlen("sell") && 
+            strncmp(line, "sell", wordLen) == 0) || 
+            (wordLen == strlen("bid") && strncmp(line, "bid", wordLen) == 0) ||
+            (wordLen == strlen("maxbid") && 
+            strncmp(line, "maxbid", wordLen) == 0)) {
+        if (!take_token(&params->trade, limits->tradeRate)) {
+            return false;
+        }
+    }
+    if (__atomic_add_fetch(&limits->inFlight, 1, __ATOMIC_ACQ_REL) > 
+            limits->maxInFlight && limits->maxInFlight != 0) {
+        __atomic_sub_fetch(&limits->inFlight, 1, __ATOMIC_ACQ_REL);
+        return false;
+    }
+    return true;
+}
+
+/* finish_request()
+* −−−−−−−−−−−−−−−
+* Releases the in-flight slot taken by admit_request().
+* 
+* params: The ThreadArgs struct.
+*/
+void finish_request(ThreadArgs* params) {
+    __atomic_sub_fetch(&params->limits->inFlight, 1, __ATOMIC_ACQ_REL);
+}
+
+/* write_all()
+* −−−−−−−−−−−−−−−
+* Writes a whole buffer to a socket.
+* 
+* fd: The socket.
+* buf: The bytes to write.
+* len: The number of bytes.
+*
+* Return: false if the socket failed
+*/
+bool write_all(int fd, const char* buf, long len) {
+    while (len > 0) {
+        ssize_t done = send(fd, buf, len, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        buf += done;
+        len -= done;
+    }
+    return true;
+}
+
+/* reply_space()
+* −−−−−−−−−−−−−−−
+* Makes room at the end of a connection's output buffer for a response of
+* up to len characters, its newline and terminator. The buffer only grows,
+* so once it has reached its working size responses cost no allocations.
+* 
+* params: The ThreadArgs of the connection.
+* len: The most characters the response can have.
+*
+* Return: where to write the response (valid until the next request)
+*/
+char* reply_space(ThreadArgs* params, int len) {
+    if (params->outLen + len + 2 > params->outCap) {
+        while (params->outLen + len + 2 > params->outCap) {
+            params->outCap = params->outCap ? params->outCap * 2 : 
+                    CLIENT_BUF_SIZE;
+        }
+        params->out = realloc(params->out, params->outCap);
+    }
+    return params->out + params->outLen;
+}
+
+/* reply_printf()
+* −−−−−−−−−−−−−−−
+* Formats a response into the connection's output buffer.
+* 
+* params: The ThreadArgs of the connection.
+* format: The printf format of the response.
+*
+* Return: the response (valid until the next request)
+*/
+char* reply_printf(ThreadArgs* params, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char* response = params->out + params->outLen;
+    int len = vsnprintf(response, params->out ? 
+            params->outCap - params->outLen : 0, format, args);
+    va_end(args);
+    if (params->outLen + len + 2 > params->outCap) {
+        response = reply_space(params, len);
+        va_start(args, format);
+        vsprintf(response, format, args);
+        va_end(args);
+    }
+    return response;
+}
+
+/* queue_reply()
+* −−−−−−−−−−−−−−−
+* Queues a response and its newline on the connection's output buffer. The
+* response is either a constant or was built in place by reply_space() or
+* reply_printf().
+* 
+* params: The ThreadArgs of the connection.
+* response: The response.
+*/
+void queue_reply(ThreadArgs* params, const char* response) {
+    int len = strlen(response);
+    if (response != params->out + params->outLen) {
+        memcpy(reply_space(params, len), response, len);
+    }
+    params->outLen += len;
+    params->out[params->outLen++] = '\n';
+}
+
+/* flush_replies()
+* −−−−−−−−−−−−−−−
+* Writes out the responses queued on a connection's output buffer, unless 
+* the client is not keeping up: what the kernel still holds from earlier 
+* writes counts against --maxbacklog, the batch about to be written does 
+* not.
+* 
+* params: The ThreadArgs of the connection.
+*
+* Return: false if the socket failed or the client was evicted
+*/
+bool flush_replies(ThreadArgs* params) {
+    bool written = 
+            !client_backlogged(params->fdptr, 0, params->limits->maxBacklog) &&
+            write_all(params->fdptr, params->out, params->outLen);
+    params->outLen = 0;
+    return written;
+}
+
+/* append_bytes()
+* −−−−−−−−−−−−−−−
+* Appends bytes to a growable buffer.
+* 
+* buf: The buffer.
+* len: The buffer's current length.
+* cap: The buffer's capacity.
+* src: The bytes to append.
+* n: The number of bytes to append.
+*/
+void append_bytes(char** buf, int* len, int* cap, const char* src, int n) {
+    if (*len + n > *cap) {
+        while (*len + n > *cap) {
+            *cap = *cap ? *cap * 2 : CLIENT_BUF_SIZE;
+        }
+        *buf = realloc(*buf, *cap);
+    }
+    memcpy(*buf + *len, src, n);
+    *len += n;
+}
+
+/* send_notice()
+* −−−−−−−−−−−−−−−
+* Sends a notification line to a client other than the one being served, 
+* formatted on the stack, or on the heap if the item name makes it too long
+* for NOTICE_BUFFER. Clients of the io_uring loop get it queued behind 
+* their replies; others get it written straight away. Caller holds the 
+* auction lock.
+* 
+* notices: The Notices queue.
+* client: The id of the client.
+* fd: The client's file descriptor.
+* format: The printf format of the notification.
+* name: The item name.
+* price: The price.
+*/
+void send_notice(Notices* notices, int client, int fd, const char* format, 
+        const char* name, int price) {
+    char buffer[NOTICE_BUFFER];
+    char* notice = buffer;
+    int len = snprintf(buffer, NOTICE_BUFFER, format, name, price);
+    if (len + 1 >= NOTICE_BUFFER) {
+        notice = malloc(len + 2);
+        sprintf(notice, format, name, price);
+    }
+    notice[len++] = '\n';
+    if (notices->wake[1] < 0) {
+        write_all(fd, notice, len);
+    } else {
+        bool idle = notices->len == 0;
+        append_bytes(&notices->buf, &notices->len, &notices->cap, 
+                (char*)&client, sizeof(int));
+        append_bytes(&notices->buf, &notices->len, &notices->cap, 
+                (char*)&len, sizeof(int));
+        append_bytes(&notices->buf, &notices->len, &notices->cap, notice, 
+                len);
+        char byte = 0;
+        if (idle && !pthread_equal(pthread_self(), notices->loop)) {
+            while (write(notices->wake[1], &byte, 1) < 0 && errno == EINTR) {
+            }
+        }
+    }
+    if (notice != buffer) {
+        free(notice);
+    }
+}
+
+/* next_notice()
+* −−−−−−−−−−−−−−−
+* Reads the next record from the queue of notices for the io_uring loop.
+* Caller holds the auction lock.
+* 
+* notices: The Notices queue.
+* off: The offset of the record, advanced past it.
+* client: Where to store the id of the client.
+* len: Where to store the length of the notice.
+*
+* Return: the notice, or NULL at the end of the queue
+*/
+char* next_notice(Notices* notices, int* off, int* client, int* len) {
+    if (*off >= notices->len) {
+        return NULL;
+    }
+    memcpy(client, notices->buf + *off, sizeof(int));
+    memcpy(len, notices->buf + *off + sizeof(int), sizeof(int));
+    char* notice = notices->buf + *off + 2 * sizeof(int);
+    *off += 2 * sizeof(int) + *len;
+    return notice;
+}
+
+/* flush_notices()
+* −−−−−−−−−−−−−−−
+* Writes the notices still queued for the io_uring loop straight to their
+* clients, once the loop has parked for a handoff. Caller holds the 
+* auction lock.
+* 
+* data: A pointer to the AuctionData struct
+*/
+void flush_notices(AuctionData* data) {
+    Notices* notices = &data->notices;
+    int off = 0;
+    int client, len;
+    char* notice;
+    while ((notice = next_notice(notices, &off, &client, &len)) != NULL) {
+        int fd = active_fd(client, data->clients, data->totalCon);
+        if (fd >= 0) {
+            write_all(fd, notice, len);
+        }
+    }
+    notices->len = 0;
+}
+
+/* process_sell()
+* −−−−−−−−−−−−−−−
+* Processes a sell request and adds item if it meets the requirements.
+* 
+* line: The client input line
+* params: The ThreadArgs struct
+* numArgs: The number of arguments in the sell request.
+* fields: The array of fields in the sell request.
+* 
+* Return: a response message whether the sell request was valid or not
+*/
+char* process_sell(char* line, ThreadArgs* params, int numArgs, 
+        char** fields) {
+    params->stats->sellRequest++;
+    if (numArgs == SELL_ARGS_NO) {
+        Auction* auction = params->auction;
+        if (check_digits(fields[RESERVE]) && check_digits(fields[DURATION])) {
+            if (find_item(auction, fields[SELL_NAME]) != -1) {
+                return REJECTED; 
+            }
+            int reserve = atoi(fields[RESERVE]);
+            double duration = atoi(fields[DURATION]) + clock_now(auction);
+            // split_fields() split the line in place, so measure to the
+            // end of the last field: -7 for "sell" and spaces, +5 for 
+            // spaces, "0" bid and "|"
+            int charLen = fields[DURATION] + strlen(fields[DURATION]) - line -
+                    2;
+            if (reserve > 0 && atoi(fields[DURATION]) >= 1) {
+                params->stats->sellAccepted++;
+                ItemInfo item = {.owner = params->client, .highestBidder = 0, 
+                    .reserve = reserve, .ceiling = 0};
+                add_item(auction, fields[SELL_NAME], item, duration, charLen);
+                return reply_printf(params, LISTED, fields[SELL_NAME]);
+            } else {
+                return INVALID;
+            }
+        } else {
+            return INVALID;
+        }
+    } else {
+        return INVALID;
+    }
+}
+
+/* set_highest_bid()
+* −−−−−−−−−−−−−−−
+* Sets an item's current price, keeping its list entry length in step.
+* 
+* auction: The Auction struct.
+* i: The index of the item.
+* bid: The new price.
+*/
+void set_highest_bid(Auction* auction, int i, int bid) {
+    auction->listLen[i] += snprintf(NULL, 0, "%d", bid) - 
+            snprintf(NULL, 0, "%d", auction->highestBid[i]);
+    auction->highestBid[i] = bid;
+    record_change(auction, item_name(auction, i));
+}
+
+/* notify_outbid()
+* −−−−−−−−−−−−−−−
+* Tells a bidder who has lost the lead on an item the new price.
+* 
+* params: The ThreadArgs struct
+* client: The id of the outbid client.
+* name: The item name.
+* price: The item's new price.
+*/
+void notify_outbid(ThreadArgs* params, int client, const char* name, 
+        int price) {
+    int fd = active_fd(client, *params->clients, *params->totalCon);
+    if (fd >= 0 && !client_backlogged(fd, 0, params->limits->maxBacklog)) {
+        send_notice(params->notices, client, fd, OUTBID, name, price);
+    }
+}
+
+/* process_bid()
+* −−−−−−−−−−−−−−−
+* Processes a bid or maxbid request.
+* A plain bid offers exactly its amount. A maxbid sets a ceiling, and the
+* server bids for the client, one more than any competitor, up to it.
+* Only the leader's ceiling is kept: a new bid is resolved against it in 
+* one step, so only the final price and one :outbid are sent. On equal 
+* ceilings the earlier bidder keeps the lead.
+* 
+* line: The client input line
+* params: The ThreadArgs struct
+* numArgs: The number of arguments in the sell request.
+* fields: The array of fields in the sell request.
+* response: The response message to be sent back to the client.
+* proxy: true for maxbid, false for bid.
+* 
+* Return: a response message whether the bid was valid or not. A bid that
+* is accepted but immediately beaten by the leader's ceiling gets :bid 
+* followed by :outbid.
+*/
+char* process_bid(char* line, ThreadArgs* params, int numArgs, char** fields, 
+        char* response, bool proxy) {
+    params->stats->bidReceived++;
+    int client = params->client;
+    if (numArgs == BID_ARGS) {
+        if (!check_digits(fields[BID_ARGS_NO])) {
+            return INVALID;
+        }
+        int bid = atoi(fields[BID_ARGS_NO]);
+        if (bid < 1) {
+            return INVALID;
+        }
+        Auction* auction = params->auction;
+        int i = find_item(auction, fields[BID_NAME_ARGS_NO]);
+        if (i == -1) {
+            return REJECTED;
+        }
+        ItemInfo* item = &auction->info[i];
+        const char* name = item_name(auction, i);
+        int leader = item->highestBidder;
+        if (bid < item->reserve || item->owner == client || 
+                bid <= auction->highestBid[i] || 
+                (leader == client && (!proxy || bid <= item->ceiling))) {
+            return REJECTED;
+        }
+        params->stats->bidAccepted++;
+        // The price can be one more than bid, so allow an extra digit
+        response = reply_space(params, snprintf(NULL, 0, ":bid %s\n" OUTBID, 
+                name, name, bid) + 1);
+        sprintf(response, ":bid %s", name);
+        if (leader == client) {
+            item->ceiling = bid;
+        } else if (leader != 0 && item->ceiling >= bid) {
+            int price = bid < item->ceiling ? bid + 1 : bid;
+            set_highest_bid(auction, i, price);
+            sprintf(response + strlen(response), "\n" OUTBID, name, price);
+        } else {
+            int price = bid;
+            if (proxy) {
+                price = leader == 0 ? item->reserve : item->ceiling + 1;
+            }
+            if (leader != 0) {
+                notify_outbid(params, leader, name, price);
+            }
+            set_highest_bid(auction, i, price);
+            item->highestBidder = client;
+            item->ceiling = bid;
+        }
+        return response;
+    } else {
+        return INVALID;
+    }
+}
+
+/* list_entry()
+* −−−−−−−−−−−−−−−
+* Writes the list entry of an open item.
+* 
+* auction: The Auction struct.
+* i: The index of the item.
+* now: The current time.
+* end: Where to write the entry.
+* limit: The end of the response buffer.
+*
+* Return: the number of characters written
+*/
+int list_entry(Auction* auction, int i, double now, char* end, char* limit) {
+    double remainTime = (auction->expiry[i] - now);
+    if (remainTime < 1) {
+        remainTime = 0;
+    }
+    return snprintf(end, limit - end, "%s %d %d %d|", item_name(auction, i), 
+            auction->info[i].reserve, auction->highestBid[i], 
+            (int)remainTime);
+}
+
+/* make_list()
+* −−−−−−−−−−−−−−−
+* Iterates through the auction's items and creates a list of open items 
+* 
+* param: The ThreadArgs struct
+* response: The string to store the list of items, already holding ":list ".
+* responseLen: The maximum length of the response string.
+*/
+void make_list(ThreadArgs* params, char* response, int responseLen) {
+    Auction* auction = params->auction;
+    char* end = response + strlen(response);
+    double now = clock_now(auction);
+    for (int i = 0; i < auction->numItems; i++) {
+        end += list_entry(auction, i, now, end, response + responseLen);
+    }
+}
+
+/* changed_names()
+* −−−−−−−−−−−−−−−
+* Walks the change journal from the newest change back to the one after a
+* version and collects each changed name once. Caller holds the auction 
+* lock and has checked that the journal still reaches back that far.
+* 
+* auction: The Auction struct.
+* since: The version the client last saw.
+* numChanged: Where to store the number of names collected.
+*
+* Return: a malloc'd array of the journal slots holding the names
+*/
+int* changed_names(Auction* auction, unsigned long since, int* numChanged) {
+    int count = auction->version - since;
+    int* changed = malloc((count + 1) * sizeof(int));
+    int seenSize = 1;
+    while (seenSize < count * 2) {
+        seenSize *= 2;
+    }
+    int* seen = calloc(seenSize, sizeof(int));
+    *numChanged = 0;
+    for (unsigned long v = auction->version; v > since; v--) {
+        int slot = v % JOURNAL_SIZE;
+        const char* name = auction->journal[slot].name;
+        int pos = hash_name(name) & (seenSize - 1);
+        while (seen[pos] != 0 && 
+                strcmp(name, auction->journal[seen[pos] - 1].name) != 0) {
+            pos = (pos + 1) & (seenSize - 1);
+        }
+        if (seen[pos] == 0) {
+            seen[pos] = slot + 1;
+            changed[(*numChanged)++] = slot;
+        }
+    }
+    free(seen);
+    return changed;
+}
+
+/* process_list_since()
+* −−−−−−−−−−−−−−−
+* Lists only the items that changed after the version the client last saw.
+* Open items have their usual list entry and closed items are listed as
+* "<name> closed|". If the journal no longer reaches back to that version, 
+* the full list is sent as a snapshot instead. Caller holds the auction 
+* lock.
+* 
+* params: The ThreadArgs struct
+* numArgs: The number of arguments in the list request.
+* fields: The array of fields in the list request.
+*
+* Return: ":changes <version> <entries>" or ":snapshot <version> <entries>",
+* or :invalid if the request is malformed
+*/
+char* process_list_since(ThreadArgs* params, int numArgs, char** fields) {
+    if (numArgs != SINCE_ARGS_NO || strcmp(fields[1], "since") != 0 ||
+            fields[2][0] == '\0' || !check_digits(fields[2])) {
+        return INVALID;
+    }
+    Auction* auction = params->auction;
+    unsigned long since = strtoul(fields[2], NULL, 10);
+    unsigned long version = auction->version;
+    if (since > version || version - since > JOURNAL_SIZE) {
+        int headerLen = snprintf(NULL, 0, SNAPSHOT, version);
+        int responseLen = headerLen + 2 + list_length(auction);
+        char* response = reply_space(params, responseLen);
+        sprintf(response, SNAPSHOT SPACE, version);
+        make_list(params, response, responseLen);
+        if (auction->numItems == 0) {
+            response[headerLen] = '\0';
+        }
+        return response;
+    }
+    int numChanged;
+    int* changed = changed_names(auction, since, &numChanged);
+    int headerLen = snprintf(NULL, 0, CHANGES, version);
+    int responseLen = headerLen + 2;
+    for (int c = 0; c < numChanged; c++) {
+        const char* name = auction->journal[changed[c]].name;
+        int i = find_item(auction, name);
+        responseLen += i >= 0 ? auction->listLen[i] : 
+                (int)(strlen(name) + strlen(CLOSED));
+    }
+    char* response = reply_space(params, responseLen);
+    char* end = response + sprintf(response, CHANGES, version);
+    if (numChanged > 0) {
+        *end++ = BLANK;
+    }
+    double now = clock_now(auction);
+    for (int c = 0; c < numChanged; c++) {
+        const char* name = auction->journal[changed[c]].name;
+        int i = find_item(auction, name);
+        if (i >= 0) {
+            end += list_entry(auction, i, now, end, response + responseLen);
+        } else {
+            end += sprintf(end, "%s" CLOSED, name);
+        }
+    }
+    *end = '\0';
+    free(changed);
+    return response;
+}
+
+/* process_history()
+* −−−−−−−−−−−−−−−
+* Looks up the results of closed auctions of an item, newest first, by
+* following the item's chain of history records from the index.
+* 
+* params: The ThreadArgs struct
+* numArgs: The number of arguments in the history request.
+* fields: The array of fields in the history request.
+* 
+* Return: ":history <item>" followed by "<reserve> <price>|" per closed 
+* auction (price 0 if unsold), or :invalid
+*/
+char* process_history(ThreadArgs* params, int numArgs, char** fields) {
+    if (numArgs != HISTORY_ARGS) {
+        return INVALID;
+    }
+    History* history = &params->auction->history;
+    const char* name = fields[1];
+    long offset = *history_slot(history, name);
+    int count = 0;
+    for (long at = offset; at != -1; count++) {
+        long back;
+        int reserve, price, nameLen;
+        history_record(history, at, &back, &reserve, &price, &nameLen);
+        at = back ? at - back : -1;
+    }
+    int responseLen = strlen(":history ") + strlen(name) + 1 + 
+            count * (2 * VARINT_MAX + 2) + 1;
+    char* response = reply_space(params, responseLen);
+    char* end = response + sprintf(response, ":history %s", name);
+    char* separator = " ";
+    while (offset != -1) {
+        long back;
+        int reserve, price, nameLen;
+        history_record(history, offset, &back, &reserve, &price, &nameLen);
+        end += sprintf(end, "%s%d %d|", separator, reserve, price);
+        separator = "";
+        offset = back ? offset - back : -1;
+    }
+    return response;
+}
+
+/* split_fields()
+* −−−−−−−−−−−−−−−
+* Splits a request line in place at every space, as split_by_char() does, 
+* but into a caller's array instead of an allocated one. Splitting stops 
+* once there are more fields than any request has.
+* 
+* line: The line to split.
+* fields: Room for MAX_INPUT_FIELDS + 2 field pointers; NULL terminated.
+*
+* Return: the number of fields, more than MAX_INPUT_FIELDS if too many
+*/
+int split_fields(char* line, char** fields) {
+    int numFields = 0;
+    fields[numFields++] = line;
+    for (char* c = line; *c != '\0' && numFields <= MAX_INPUT_FIELDS; c++) {
+        if (*c == BLANK) {
+            *c = '\0';
+            fields[numFields++] = c + 1;
+        }
+    }
+    fields[numFields] = NULL;
+    return numFields;
+}
+
+#ifdef VIRTUAL_CLOCK
+/* process_advance()
+* −−−−−−−−−−−−−−−
+* Processes an advance request (test builds only): moves the virtual clock 
+* forward and waits until the expiry thread has closed everything that is
+* due by the new time. Caller holds the auction lock.
+* 
+* params: The ThreadArgs struct.
+* numArgs: The number of fields in the request.
+* fields: The fields of the request.
+*
+* Return: the response to the client
+*/
+char* process_advance(ThreadArgs* params, int numArgs, char** fields) {
+    if (numArgs != ADVANCE_ARGS_NO || !check_digits(fields[1])) {
+        return INVALID;
+    }
+    Clock* clock = &params->auction->clock;
+    clock->now += atoi(fields[1]);
+    double target = clock->now;
+    pthread_cond_broadcast(&clock->advanced);
+    while (clock->swept < target) {
+        pthread_cond_wait(&clock->advanced, &params->auction->lock);
+    }
+    return ADVANCED;
+}
+#endif
+
+/* process_request()
+* −−−−−−−−−−−−−−−
+* Processes an admitted request and returns a response.
+* 
+* line: The line of input to process.
+* params: The ThreadArgs struct.
+*
+* Return A response to the client's input.
+*/
+char* process_request(char* line, ThreadArgs* params) {
+    char* fields[MAX_INPUT_FIELDS + 2];
+    int numArgs = split_fields(line, fields);
+    char* command = fields[0];
+    char* response = NULL;
+    if (numArgs > MAX_INPUT_FIELDS) {
+        return INVALID;
+    } else {
+        if (strcmp(command, "sell") == 0) {
+            pthread_mutex_lock(&params->auction->lock);
+            response = process_sell(line, params, numArgs, fields);
+            pthread_mutex_unlock(&params->auction->lock);
+        } else if (strcmp(command, "bid") == 0) {
+            pthread_mutex_lock(&params->auction->lock);
+            response = process_bid(line, params, numArgs, fields, 
+                    response, false);
+            pthread_mutex_unlock(&params->auction->lock);
+        } else if (strcmp(command, "maxbid") == 0) {
+            pthread_mutex_lock(&params->auction->lock);
+            response = process_bid(line, params, numArgs, fields, 
+                    response, true);
+            pthread_mutex_unlock(&params->auction->lock);
+        } else if (strcmp(command, "history") == 0) {
+            pthread_mutex_lock(&params->auction->lock);
+            response = process_history(params, numArgs, fields);
+            pthread_mutex_unlock(&params->auction->lock);
+        } else if (strcmp(command, "list") == 0 && numArgs == 1) {
+            response = ":list";
+            pthread_mutex_lock(&params->auction->lock);
+            int entriesLen = list_length(params->auction);
+            if (entriesLen == 0) {
+                pthread_mutex_unlock(&params->auction->lock);
+                return response;
+            }
+            // For ":list " and terminator
+            int responseLen = BUFFER_LEN + 2 + entriesLen;
+            char* response = reply_space(params, responseLen);
+            strcpy(response, ":list ");
+            make_list(params, response, responseLen);
+            pthread_mutex_unlock(&params->auction->lock);
+            return response;
+        } else if (strcmp(command, "list") == 0) {
+            pthread_mutex_lock(&params->auction->lock);
+            response = process_list_since(params, numArgs, fields);
+            pthread_mutex_unlock(&params->auction->lock);
+#ifdef VIRTUAL_CLOCK
+        } else if (strcmp(command, "advance") == 0) {
+            pthread_mutex_lock(&params->auction->lock);
+            response = process_advance(params, numArgs, fields);
+            pthread_mutex_unlock(&params->auction->lock);
+#endif
+        } else {
+            return INVALID;
+        }
+    }
+    return response;
+}
+
+/* process_line()
+* −−−−−−−−−−−−−−−
+* Processes a line of input from a client and returns a response, or :busy 
+* if the client is over its rate limit or the server is at its in-flight
+* limit.
+* 
+* line: The line of input to process.
+* params: The ThreadArgs struct.
+*
+* Return A response to the client's input.
+*/
+char* process_line(char* line, ThreadArgs* params) {
+    capture_record(params, line);
+    if (!admit_request(line, params)) {
+        return BUSY;
+    }
+    char* response = process_request(line, params);
+    finish_request(params);
+    return response;
+}
+
+/* close_item()
+* −−−−−−−−−−−−−−−
+* Moves an expired item from the auction to the history store and notifies 
+* the highest bidder and owner.
+* If no bids, it notifies only the owner.
+* 
+* data: a pointer to the AuctionData struct 
+* i: The index of the expired item.
+*/
+void close_item(AuctionData* data, int i) {
+    Auction* auction = data->auction;
+    ItemInfo* item = &auction->info[i];
+    const char* name = item_name(auction, i);
+    int highestBid = auction->highestBid[i];
+    int maxBacklog = data->limits.maxBacklog;
+    history_append(&auction->history, name, item->reserve, 
+            item->highestBidder != 0 ? highestBid : 0);
+    int owner = active_fd(item->owner, data->clients, data->totalCon);
+    int winner = active_fd(item->highestBidder, data->clients, 
+            data->totalCon);
+    if (item->highestBidder != 0) {
+        if (owner >= 0 && !client_backlogged(owner, 0, maxBacklog)) {
+            send_notice(&data->notices, item->owner, owner, ":sold %s %d", 
+                    name, highestBid);
+        }
+        if (winner >= 0 && !client_backlogged(winner, 0, maxBacklog)) {
+            send_notice(&data->notices, item->highestBidder, winner, 
+                    ":won %s %d", name, highestBid);
+        }
+    } else {
+        if (owner >= 0 && !client_backlogged(owner, 0, maxBacklog)) {
+            send_notice(&data->notices, item->owner, owner, ":unsold %s", 
+                    name, 0);
+        }
+    }
+    record_change(auction, name);
+    remove_item(auction, i);
+}
+
+/* expiry_thread()
+* −−−−−−−−−−−−−−−
+* Thread that checks when auctoins expire
+* Scans the packed expiry array a block at a time and only walks the items
+* of a block that has something due. Closed items are left as gaps that 
+* are compacted once the sweep is done.
+* 
+* arg: a pointer to the AuctionData struct 
+* 
+* Return NULL
+*/
+void* expiry_thread(void* arg) {
+    AuctionData* data = (AuctionData*)arg;
+    Auction* auction = data->auction;
+    while (1) {
+        pthread_mutex_lock(&auction->lock);
+        double currentTime = clock_now(auction);
+        int start = (auction->numItems - 1) / EXPIRY_BLOCK * EXPIRY_BLOCK;
+        for (; start >= 0; start -= EXPIRY_BLOCK) {
+            int end = start + EXPIRY_BLOCK;
+            if (end > auction->numItems) {
+                end = auction->numItems;
+            }
+            int due = 0;
+            for (int i = start; i < end; i++) {
+                due |= currentTime >= auction->expiry[i];
+            }
+            if (!due) {
+                continue;
+            }
+            for (int i = end - 1; i >= start; i--) {
+                if (currentTime >= auction->expiry[i]) {
+                    close_item(data, i);
+                }
+            }
+        }
+        compact_items(auction);
+        clock_sleep(auction, currentTime);
+    }
+
+    return NULL;
+}
+
+/* register_client()
+* −−−−−−−−−−−−−−−
+* Records a newly accepted client as active and builds the per-connection
+* arguments used to process its requests.
+* 
+* data: A pointer to the AuctionData struct
+* fd: The file descriptor of the accepted client.
+* client: The registry id takeover() gave a connection taken over from an
+* old server, or 0 for a new client.
+*
+* Return: the malloc'd ThreadArgs for the connection
+*/
+ThreadArgs* register_client(AuctionData* data, int fd, int client) {
+    pthread_mutex_lock(&data->lock);
+    (data->numCon)++;
+    pthread_mutex_unlock(&data->lock);
+    if (client == 0) {
+        pthread_mutex_lock(&data->auction->lock);
+        data->clients = realloc(data->clients, (data->totalCon + 1) * 
+                sizeof(ActiveClient));
+        ActiveClient entry = {.fd = fd, .active = true};
+        data->clients[data->totalCon] = entry;
+        client = ++(data->totalCon);
+        pthread_mutex_unlock(&data->auction->lock);
+    }
+
+    ThreadArgs* params = malloc(sizeof(ThreadArgs));
+    double now = get_time_ms();
+    Bucket trade = {.tokens = data->limits.tradeRate, .last = now};
+    Bucket list = {.tokens = data->limits.listRate, .last = now};
+    ThreadArgs threadArgs = {.fdptr = fd, .client = client, 
+            .curCon = &data->numCon, 
+            .lock = &data->lock, .slotFree = &data->slotFree,
+            .auction = data->auction, .stats = data->stats, 
+            .clients = &data->clients, .totalCon = &data->totalCon,
+            .limits = &data->limits, .trade = trade, .list = list,
+            .handoff = &data->handoff, .capture = &data->capture, 
+            .notices = &data->notices, 
+            .session = __atomic_fetch_add(&data->capture.nextSession, 1, 
+            __ATOMIC_RELAXED), .in = NULL, .inOff = 0, .inLen = 0,
+            .inCap = 0, .out = NULL, .outLen = 0, .outCap = 0};
+    *params = threadArgs;
+    return params;
+}
+
+/* unregister_client()
+* −−−−−−−−−−−−−−−
+* Marks a disconnected client as inactive and ends its capture session.
+* The caller still owns the file descriptor and params, and closes the fd
+* afterwards so that no notice can be sent to whoever reuses it.
+* 
+* params: The ThreadArgs of the disconnected client.
+*/
+void unregister_client(ThreadArgs* params) {
+    capture_record(params, NULL);
+    pthread_mutex_lock(&params->auction->lock);
+    (*params->clients)[params->client - 1].active = false;
+    pthread_mutex_unlock(&params->auction->lock);
+    pthread_mutex_lock(params->lock);
+    (*params->curCon)--;
+    pthread_cond_broadcast(params->slotFree);
+    pthread_mutex_unlock(params->lock);
+}
+
+/* handoff_readable()
+* −−−−−−−−−−−−−−−
+* Waits until a socket can be read, unless a handoff starts first. Without
+* --handoff this returns straight away and the caller's read blocks instead.
+* 
+* handoff: The Handoff state.
+* fd: The socket to wait on.
+*
+* Return: false if a handoff has started
+*/
+bool handoff_readable(Handoff* handoff, int fd) {
+    if (handoff->path == NULL) {
+        return true;
+    }
+    struct pollfd fds[] = {{.fd = handoff->wake[0], .events = POLLIN}, 
+            {.fd = fd, .events = POLLIN}};
+    while (poll(fds, 2, -1) < 0 && errno == EINTR) {
+    }
+    return !(fds[0].revents & POLLIN);
+}
+
+/* handoff_park_client()
+* −−−−−−−−−−−−−−−
+* Parks a client thread for a handoff, leaving its connection and the 
+* unprocessed bytes read from it to be sent to the successor. Only returns
+* if the successor failed to take over, or the handoff was already given up.
+* 
+* params: The ThreadArgs of the client.
+*/
+void handoff_park_client(ThreadArgs* params) {
+    Handoff* handoff = params->handoff;
+    if (params->capture->fd != -1) {
+        capture_flush(params->capture);
+    }
+    pthread_mutex_lock(params->lock);
+    if (!handoff->active) {
+        pthread_mutex_unlock(params->lock);
+        return;
+    }
+    handoff->conns = realloc(handoff->conns, (handoff->numConns + 1) * 
+            sizeof(HandoffConn));
+    HandoffConn conn = {.fd = params->fdptr, .client = params->client,
+            .in = params->in + params->inOff, 
+            .inLen = params->inLen - params->inOff};
+    handoff->conns[handoff->numConns++] = conn;
+    pthread_cond_broadcast(params->slotFree);
+    unsigned long failures = handoff->failures;
+    while (handoff->failures == failures) {
+        pthread_cond_wait(params->slotFree, params->lock);
+    }
+    pthread_mutex_unlock(params->lock);
+}
+
+/* next_request()
+* −−−−−−−−−−−−−−−
+* Returns the next request line from a client, reading more from the 
+* socket into the connection's input buffer when no full line is buffered.
+* A final line without a newline is returned at end of file. Parks the 
+* thread if a handoff starts while waiting for input.
+* 
+* params: The ThreadArgs of the client.
+*
+* Return: the line (valid until the next call), or NULL at end of file
+*/
+char* next_request(ThreadArgs* params) {
+    while (1) {
+        char* start = params->in + params->inOff;
+        int buffered = params->inLen - params->inOff;
+        char* newline = buffered ? memchr(start, '\n', buffered) : NULL;
+        if (newline != NULL) {
+            *newline = '\0';
+            params->inOff = newline + 1 - params->in;
+            return start;
+        }
+        if (buffered > 0) {
+            memmove(params->in, start, buffered);
+        }
+        params->inOff = 0;
+        params->inLen = buffered;
+        // Keep room for the terminator of a final unterminated line
+        if (params->inCap - params->inLen < 2) {
+            params->inCap = params->inCap ? params->inCap * 2 : 
+                    CLIENT_BUF_SIZE;
+            params->in = realloc(params->in, params->inCap);
+        }
+        // Responses to the lines just processed go out in one write
+        if (params->outLen > 0 && !flush_replies(params)) {
+            return NULL;
+        }
+        // An idle session's records must not wait for its next request
+        capture_flush(params->capture);
+        if (!handoff_readable(params->handoff, params->fdptr)) {
+            handoff_park_client(params);
+            continue;
+        }
+        ssize_t got = read(params->fdptr, params->in + params->inLen, 
+                params->inCap - params->inLen - 1);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            if (params->inLen == 0) {
+                return NULL;
+            }
+            params->in[params->inLen] = '\0';
+            params->inOff = params->inLen;
+            return params->in;
+        }
+        params->inLen += got;
+    }
+}
+
+/* client_thread()
+* −−−−−−−−−−−−−−−
+* Thread that handles communication with a client.
+* Reads input from client and processes it.
+* 
+* arg: A void pointer to a ThreadArgs struct 
+* 
+* Return NULL
+*/
+void* client_thread(void* arg) {
+    ThreadArgs* params = (ThreadArgs*)arg;
+    int fd = params->fdptr;
+    char* currentIn;
+    while ((currentIn = next_request(params)) != NULL) {
+        queue_reply(params, process_line(currentIn, params));
+    }
+    flush_replies(params);
+    unregister_client(params);
+
+    close(fd);
+    free(params->in);
+    free(params->out);
+    free(params);
+    free(captureBuf.buf);
+
+    return NULL;
+}
+
+/* handoff_park_acceptor()
+* −−−−−−−−−−−−−−−
+* Parks an accept loop for a handoff. Only returns if the successor failed
+* to take over, or the handoff was already given up.
+* 
+* data: A pointer to the AuctionData struct
+*/
+void handoff_park_acceptor(AuctionData* data) {
+    Handoff* handoff = &data->handoff;
+    pthread_mutex_lock(&data->lock);
+    if (!handoff->active) {
+        pthread_mutex_unlock(&data->lock);
+        return;
+    }
+    handoff->parkedAcceptors++;
+    pthread_cond_broadcast(&data->slotFree);
+    unsigned long failures = handoff->failures;
+    while (handoff->failures == failures) {
+        pthread_cond_wait(&data->slotFree, &data->lock);
+    }
+    pthread_mutex_unlock(&data->lock);
+}
+
+/* process_connections()
+* −−−−−−−−−−−−−−−
+* Processes incoming connections from clients on a listening socket and 
+* creates a new thread to handle each client.
+* If max connections is set, it will wait until a client disconnects before
+* serving a new connection.
+* 
+* data: A pointer to the AuctionData struct
+* listenFd: The listening socket (TCP or Unix domain).
+*
+* Errors: if the socket cant be accepted
+*/
+void process_connections(AuctionData* data, int listenFd) {
+    int fd;
+    struct sockaddr_storage fromAddr;
+    socklen_t fromAddrSize;
+
+    int maxCon = data->maxConnections;
+
+    while (1) {
+        pthread_mutex_lock(&data->lock);
+        while (maxCon != 0 && data->numCon >= maxCon && 
+                !data->handoff.active) {
+            pthread_cond_wait(&data->slotFree, &data->lock);
+        }
+        pthread_mutex_unlock(&data->lock);
+        if (!handoff_readable(&data->handoff, listenFd)) {
+            handoff_park_acceptor(data);
+            continue;
+        }
+        fromAddrSize = sizeof(fromAddr);
+        fd = accept(listenFd, (struct sockaddr*)&fromAddr, &fromAddrSize);
+        data->fdptr = fd;
+        if (fd < 0) {
+            perror("Error accepting connection");
+            exit(1);
+        }
+        ThreadArgs* threadArgs = register_client(data, fd, 0);
+
+        pthread_t threadId;
+        pthread_create(&threadId, NULL, client_thread, threadArgs);
+        pthread_detach(threadId);
+
+    }
+}
+
+/* unix_thread()
+* −−−−−−−−−−−−−−−
+* Thread that accepts connections on the Unix domain socket, serving them 
+* exactly like TCP connections.
+* 
+* arg: A pointer to the AuctionData struct
+*/
+void* unix_thread(void* arg) {
+    AuctionData* data = (AuctionData*)arg;
+    process_connections(data, data->fdUnix);
+    return NULL;
+}
+
+/* put_snapshot_varint()
+* −−−−−−−−−−−−−−−
+* Appends a varint to a handoff snapshot.
+* 
+* snap: The snapshot buffer.
+* len: The snapshot's current length.
+* cap: The snapshot's capacity.
+* value: The value to append.
+*/
+void put_snapshot_varint(char** snap, int* len, int* cap, 
+        unsigned long value) {
+    unsigned char buf[VARINT_MAX];
+    append_bytes(snap, len, cap, (char*)buf, put_varint(buf, value));
+}
+
+/* put_snapshot_bytes()
+* −−−−−−−−−−−−−−−
+* Appends a length-prefixed string of bytes to a handoff snapshot.
+* 
+* snap: The snapshot buffer.
+* len: The snapshot's current length.
+* cap: The snapshot's capacity.
+* bytes: The bytes to append.
+* n: The number of bytes.
+*/
+void put_snapshot_bytes(char** snap, int* len, int* cap, const char* bytes,
+        long n) {
+    put_snapshot_varint(snap, len, cap, n);
+    if (n > 0) {
+        append_bytes(snap, len, cap, bytes, n);
+    }
+}
+
+/* handoff_snapshot()
+* −−−−−−−−−−−−−−−
+* Serialises everything a successor needs to carry on: the connections' 
+* unprocessed input, the Stat counters, the connection registry, the 
+* change journal, the open items and an in-memory history log. Clients 
+* are referred to by their position among the handed over connections; 
+* items whose owner or bidder has disconnected refer to a gone client. 
+* Caller holds the data and auction locks with every connection parked.
+* 
+* data: A pointer to the AuctionData struct
+* len: Where to store the length of the snapshot.
+*
+* Return: the malloc'd snapshot
+*/
+char* handoff_snapshot(AuctionData* data, int* len) {
+    Handoff* handoff = &data->handoff;
+    Auction* auction = data->auction;
+    char* snap = NULL;
+    int cap = 0;
+    *len = 0;
+    put_snapshot_varint(&snap, len, &cap, HANDOFF_FORMAT);
+    put_snapshot_varint(&snap, len, &cap, data->fdUnix >= 0);
+    put_snapshot_varint(&snap, len, &cap, handoff->numConns);
+    for (int c = 0; c < handoff->numConns; c++) {
+        put_snapshot_bytes(&snap, len, &cap, handoff->conns[c].in, 
+                handoff->conns[c].inLen);
+    }
+    // Map client ids to connection positions + 2, leaving 0 for "no 
+    // bidder" and 1 for a client that has gone
+    int* position = calloc(data->totalCon + 1, sizeof(int));
+    for (int c = 0; c < handoff->numConns; c++) {
+        position[handoff->conns[c].client] = c + 2;
+    }
+    Stat* stats = data->stats;
+    put_snapshot_varint(&snap, len, &cap, stats->sellRequest);
+    put_snapshot_varint(&snap, len, &cap, stats->sellAccepted);
+    put_snapshot_varint(&snap, len, &cap, stats->bidReceived);
+    put_snapshot_varint(&snap, len, &cap, stats->bidAccepted);
+    put_snapshot_varint(&snap, len, &cap, data->totalCon - data->numCon);
+
+    unsigned long journalLen = auction->version < JOURNAL_SIZE ? 
+            auction->version : JOURNAL_SIZE;
+    put_snapshot_varint(&snap, len, &cap, auction->version);
+    put_snapshot_varint(&snap, len, &cap, journalLen);
+    for (unsigned long v = auction->version - journalLen + 1; 
+            v <= auction->version; v++) {
+        const char* name = auction->journal[v % JOURNAL_SIZE].name;
+        put_snapshot_bytes(&snap, len, &cap, name, strlen(name));
+    }
+
+    double now = clock_now(auction);
+    put_snapshot_varint(&snap, len, &cap, auction->numItems);
+    for (int i = 0; i < auction->numItems; i++) {
+        ItemInfo* item = &auction->info[i];
+        const char* name = item_name(auction, i);
+        int clients[] = {item->owner, item->highestBidder};
+        put_snapshot_bytes(&snap, len, &cap, name, strlen(name));
+        for (int k = 0; k < 2; k++) {
+            int client = clients[k];
+            put_snapshot_varint(&snap, len, &cap, client == 0 ? 0 : 
+                    (client > 0 && position[client]) ? 
+                    position[client] : 1);
+        }
+        put_snapshot_varint(&snap, len, &cap, item->reserve);
+        put_snapshot_varint(&snap, len, &cap, auction->highestBid[i]);
+        put_snapshot_varint(&snap, len, &cap, item->ceiling);
+        put_snapshot_varint(&snap, len, &cap, auction->listLen[i]);
+        double remain = auction->expiry[i] - now;
+        put_snapshot_varint(&snap, len, &cap, remain > 0 ? 
+                (unsigned long)(remain * 1000) : 0);
+    }
+    free(position);
+
+    History* history = &auction->history;
+    put_snapshot_bytes(&snap, len, &cap, history->base + HISTORY_HEADER, 
+            history->fd == -1 ? history->len - HISTORY_HEADER : 0);
+    return snap;
+}
+
+/* read_all()
+* −−−−−−−−−−−−−−−
+* Reads a whole buffer from a socket.
+* 
+* fd: The socket.
+* buf: Where to store the bytes.
+* len: The number of bytes.
+*
+* Return: false if the socket failed or closed early
+*/
+bool read_all(int fd, char* buf, long len) {
+    while (len > 0) {
+        ssize_t done = read(fd, buf, len);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        buf += done;
+        len -= done;
+    }
+    return true;
+}
+
+/* send_fds()
+* −−−−−−−−−−−−−−−
+* Passes file descriptors over a Unix domain socket with SCM_RIGHTS, at 
+* most HANDOFF_FD_BATCH per message.
+* 
+* sock: The Unix domain socket.
+* fds: The file descriptors.
+* numFds: The number of file descriptors.
+*
+* Return: false if the socket failed
+*/
+bool send_fds(int sock, int* fds, int numFds) {
+    for (int sent = 0; sent < numFds; sent += HANDOFF_FD_BATCH) {
+        int count = numFds - sent < HANDOFF_FD_BATCH ? numFds - sent : 
+                HANDOFF_FD_BATCH;
+        char byte = 0;
+        struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+        char control[CMSG_SPACE(HANDOFF_FD_BATCH * sizeof(int))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds + sent, count * sizeof(int));
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* recv_fds()
+* −−−−−−−−−−−−−−−
+* Receives file descriptors passed by send_fds().
+* 
+* sock: The Unix domain socket.
+* fds: Where to store the file descriptors.
+* numFds: The number of file descriptors expected.
+*
+* Return: false if the socket failed or the descriptors did not arrive
+*/
+bool recv_fds(int sock, int* fds, int numFds) {
+    int got = 0;
+    while (got < numFds) {
+        char byte;
+        struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+        char control[CMSG_SPACE(HANDOFF_FD_BATCH * sizeof(int))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, 0) != 1) {
+            return false;
+        }
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+            return false;
+        }
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (count > numFds - got) {
+            return false;
+        }
+        memcpy(fds + got, CMSG_DATA(cmsg), count * sizeof(int));
+        got += count;
+    }
+    return true;
+}
+
+/* handoff_quiesced()
+* −−−−−−−−−−−−−−−
+* Checks whether every connection has been parked for a handoff. Caller 
+* holds the data lock.
+* 
+* data: A pointer to the AuctionData struct
+*/
+bool handoff_quiesced(AuctionData* data) {
+    Handoff* handoff = &data->handoff;
+    return handoff->loopParked || 
+            (handoff->parkedAcceptors == handoff->acceptors && 
+            handoff->numConns == data->numCon);
+}
+
+/* handoff_wait_quiesced()
+* −−−−−−−−−−−−−−−
+* Waits for every connection to be parked for a handoff, for at most 
+* HANDOFF_QUIESCE_S seconds: a client thread blocked writing to a client 
+* that has stopped reading never parks. Caller holds the data lock.
+* 
+* data: A pointer to the AuctionData struct
+*
+* Return: true if everything was parked in time
+*/
+bool handoff_wait_quiesced(AuctionData* data) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += HANDOFF_QUIESCE_S;
+    while (!handoff_quiesced(data)) {
+        if (pthread_cond_timedwait(&data->slotFree, &data->lock, 
+                &deadline) == ETIMEDOUT) {
+            return handoff_quiesced(data);
+        }
+    }
+    return true;
+}
+
+/* handoff_accept()
+* −−−−−−−−−−−−−−−
+* Waits for a successor to connect to the --handoff control socket. Only 
+* a process running as the same user is accepted.
+* 
+* handoff: The Handoff state.
+*
+* Return: the successor's socket, or -1 if the control socket has failed
+*/
+int handoff_accept(Handoff* handoff) {
+    while (1) {
+        int successor = accept(handoff->listenFd, NULL, NULL);
+        if (successor < 0) {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || 
+                    errno == ENOMEM) {
+                usleep(HANDOFF_RETRY_US);
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                perror("Error accepting handoff");
+                return -1;
+            }
+            continue;
+        }
+        struct ucred cred;
+        socklen_t credLen = sizeof(cred);
+        if (getsockopt(successor, SOL_SOCKET, SO_PEERCRED, &cred, 
+                &credLen) == 0 && cred.uid == geteuid()) {
+            return successor;
+        }
+        close(successor);
+    }
+}
+
+/* handoff_resume()
+* −−−−−−−−−−−−−−−
+* Undoes a handoff the successor failed to complete, or that timed out: 
+* takes the byte back out of the wake pipe and lets every parked accept 
+* loop, client thread and the io_uring loop carry on serving. Caller holds 
+* the data and auction locks, and releases them.
+* 
+* data: A pointer to the AuctionData struct
+*/
+void handoff_resume(AuctionData* data) {
+    Handoff* handoff = &data->handoff;
+    char byte;
+    while (read(handoff->wake[0], &byte, 1) < 0 && errno == EINTR) {
+    }
+    handoff->active = false;
+    handoff->parkedAcceptors = 0;
+    handoff->loopParked = false;
+    handoff->numConns = 0;
+    handoff->failures++;
+    // The io_uring loop may still be waiting on sends rather than parked
+    if (data->notices.wake[1] >= 0) {
+        while (write(data->notices.wake[1], &byte, 1) < 0 && 
+                errno == EINTR) {
+        }
+    }
+    pthread_mutex_unlock(&data->auction->lock);
+    pthread_cond_broadcast(&data->slotFree);
+    pthread_mutex_unlock(&data->lock);
+}
+
+/* handoff_thread()
+* −−−−−−−−−−−−−−−
+* Waits for a successor to connect to the --handoff control socket, then 
+* parks every accept loop and client between requests, stops expiry by 
+* holding the auction lock, and sends the successor the listening sockets 
+* and client connections (as SCM_RIGHTS) followed by a snapshot of the 
+* state. Exits once the successor confirms it has taken over; no 
+* connection is closed. If the handoff fails, or not every connection has
+* parked within HANDOFF_QUIESCE_S seconds, serving carries on and the next
+* successor is waited for.
+* 
+* arg: A pointer to the AuctionData struct
+*/
+void* handoff_thread(void* arg) {
+    AuctionData* data = (AuctionData*)arg;
+    Handoff* handoff = &data->handoff;
+    int successor;
+    while ((successor = handoff_accept(handoff)) >= 0) {
+        // The successor listens on the control socket in our place
+        close(handoff->listenFd);
+        pthread_mutex_lock(&data->lock);
+        handoff->active = true;
+        pthread_cond_broadcast(&data->slotFree);
+        pthread_mutex_unlock(&data->lock);
+        char byte = 0;
+        while (write(handoff->wake[1], &byte, 1) < 0 && errno == EINTR) {
+        }
+
+        pthread_mutex_lock(&data->lock);
+        bool quiesced = handoff_wait_quiesced(data);
+        pthread_mutex_lock(&data->auction->lock);
+        if (quiesced) {
+            flush_notices(data);
+            int snapLen;
+            char* snap = handoff_snapshot(data, &snapLen);
+            int numFds = 0;
+            int* fds = malloc((handoff->numConns + 2) * sizeof(int));
+            fds[numFds++] = data->fdServer;
+            if (data->fdUnix >= 0) {
+                fds[numFds++] = data->fdUnix;
+            }
+            for (int c = 0; c < handoff->numConns; c++) {
+                fds[numFds++] = handoff->conns[c].fd;
+            }
+            int header[] = {numFds, snapLen};
+            if (write_all(successor, (char*)header, sizeof(header)) && 
+                    send_fds(successor, fds, numFds) && 
+                    write_all(successor, snap, snapLen) && 
+                    read(successor, &byte, 1) == 1) {
+                // The connections and state now belong to the successor
+                _exit(0);
+            }
+            free(snap);
+            free(fds);
+        }
+        // Closing the successor's socket makes it give up too
+        close(successor);
+        handoff_resume(data);
+        handoff->listenFd = listen_unix(handoff->path);
+        if (handoff->listenFd < 0) {
+            fprintf(stderr, INVALID_UNIX);
+            return NULL;
+        }
+    }
+    close(handoff->listenFd);
+    return NULL;
+}
+
+/* handoff_listen()
+* −−−−−−−−−−−−−−−
+* Opens the --handoff control socket and starts waiting for a successor.
+* 
+* data: A pointer to the AuctionData struct
+*
+* Errors: if the control socket cant be listened on
+*/
+void handoff_listen(AuctionData* data) {
+    Handoff* handoff = &data->handoff;
+    handoff->acceptors = data->fdUnix >= 0 ? 2 : 1;
+    if (handoff->path == NULL) {
+        return;
+    }
+    handoff->listenFd = listen_unix(handoff->path);
+    if (handoff->listenFd < 0 || pipe(handoff->wake) < 0) {
+        fprintf(stderr, INVALID_UNIX);
+        exit(INVALID_PORT_CODE);
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, handoff_thread, data);
+    pthread_detach(tid);
+}
+
+/* get_snapshot_bytes()
+* −−−−−−−−−−−−−−−
+* Reads a length-prefixed string of bytes from a handoff snapshot.
+* 
+* pos: Pointer to the read position.
+* n: Where to store the number of bytes.
+*
+* Return: the bytes (not terminated)
+*/
+const char* get_snapshot_bytes(const unsigned char** pos, long* n) {
+    *n = get_varint(pos);
+    const char* bytes = (const char*)*pos;
+    *pos += *n;
+    return bytes;
+}
+
+/* get_snapshot_name()
+* −−−−−−−−−−−−−−−
+* Reads a length-prefixed name from a handoff snapshot into a growable, 
+* terminated buffer.
+* 
+* pos: Pointer to the read position.
+* name: The buffer.
+* cap: The buffer's capacity.
+*
+* Return: the name
+*/
+char* get_snapshot_name(const unsigned char** pos, char** name, long* cap) {
+    long n;
+    const char* bytes = get_snapshot_bytes(pos, &n);
+    if (n + 1 > *cap) {
+        *cap = n + 1;
+        *name = realloc(*name, *cap);
+    }
+    memcpy(*name, bytes, n);
+    (*name)[n] = '\0';
+    return *name;
+}
+
+/* restore_client()
+* −−−−−−−−−−−−−−−
+* Turns a client reference from a handoff snapshot back into a client id.
+* 
+* ref: 0 for no client, 1 for a client that has gone, else the position of
+* the handed over connection + 2.
+* conns: The handed over connections.
+*/
+int restore_client(unsigned long ref, HandoffConn* conns) {
+    return ref == 0 ? 0 : ref == 1 ? GONE_CLIENT : conns[ref - 2].client;
+}
+
+/* takeover()
+* −−−−−−−−−−−−−−−
+* Connects to the old server's --handoff control socket and takes over its
+* listening sockets, client connections and state. The connections are 
+* kept in the Handoff state until they are served. The journal is rebuilt
+* after the items so that the change version carries on from the old one.
+* The history store is only opened once the snapshot has arrived, as the 
+* old server can append to a --history file until it has quiesced.
+* 
+* data: A pointer to the AuctionData struct
+*
+* Errors: if the old server can't be reached, the handoff fails or the 
+* history file can't be opened
+*/
+void takeover(AuctionData* data) {
+    Handoff* handoff = &data->handoff;
+    struct sockaddr_un addr;
+    socklen_t addrLen = unix_address(handoff->takeoverPath, &addr);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    int header[2];
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, addrLen) < 0 ||
+            !read_all(sock, (char*)header, sizeof(header))) {
+        fprintf(stderr, HANDOFF_ERR);
+        exit(HANDOFF_ERR_CODE);
+    }
+    int* fds = malloc(header[0] * sizeof(int));
+    char* snap = malloc(header[1]);
+    if (!recv_fds(sock, fds, header[0]) || 
+            !read_all(sock, snap, header[1])) {
+        fprintf(stderr, HANDOFF_ERR);
+        exit(HANDOFF_ERR_CODE);
+    }
+    const unsigned char* pos = (const unsigned char*)snap;
+    if (get_varint(&pos) != HANDOFF_FORMAT) {
+        fprintf(stderr, HANDOFF_ERR);
+        exit(HANDOFF_ERR_CODE);
+    }
+    data->fdServer = fds[0];
+    data->fdUnix = get_varint(&pos) ? fds[1] : -1;
+    int* conns = fds + (data->fdUnix >= 0 ? 2 : 1);
+    handoff->numConns = get_varint(&pos);
+    handoff->conns = malloc(handoff->numConns * sizeof(HandoffConn));
+    for (int c = 0; c < handoff->numConns; c++) {
+        long n;
+        const char* in = get_snapshot_bytes(&pos, &n);
+        HandoffConn conn = {.fd = conns[c], .in = malloc(n + 1), 
+                .inLen = n};
+        memcpy(conn.in, in, n);
+        handoff->conns[c] = conn;
+    }
+    Stat* stats = data->stats;
+    stats->sellRequest = get_varint(&pos);
+    stats->sellAccepted = get_varint(&pos);
+    stats->bidReceived = get_varint(&pos);
+    stats->bidAccepted = get_varint(&pos);
+    // Completed clients come first in the registry, then the handed over
+    // connections, which keep their ids when they are served
+    int completed = get_varint(&pos);
+    data->totalCon = completed + handoff->numConns;
+    data->clients = realloc(data->clients, (data->totalCon + 1) * 
+            sizeof(ActiveClient));
+    for (int c = 0; c < completed; c++) {
+        ActiveClient gone = {.fd = -1, .active = false};
+        data->clients[c] = gone;
+    }
+    for (int c = 0; c < handoff->numConns; c++) {
+        ActiveClient handed = {.fd = conns[c], .active = true};
+        data->clients[completed + c] = handed;
+        handoff->conns[c].client = completed + c + 1;
+    }
+
+    Auction* auction = data->auction;
+    unsigned long version = get_varint(&pos);
+    unsigned long journalLen = get_varint(&pos);
+    const unsigned char* journal = pos;
+    for (unsigned long j = 0; j < journalLen; j++) {
+        long n;
+        get_snapshot_bytes(&pos, &n);
+    }
+    int numItems = get_varint(&pos);
+    double now = clock_now(data->auction);
+    char* name = NULL;
+    long nameCap = 0;
+    for (int i = 0; i < numItems; i++) {
+        get_snapshot_name(&pos, &name, &nameCap);
+        ItemInfo item;
+        item.owner = restore_client(get_varint(&pos), handoff->conns);
+        item.highestBidder = restore_client(get_varint(&pos), 
+                handoff->conns);
+        item.reserve = get_varint(&pos);
+        int highestBid = get_varint(&pos);
+        item.ceiling = get_varint(&pos);
+        int listLen = get_varint(&pos);
+        double expiry = now + get_varint(&pos) / 1000.0;
+        add_item(auction, name, item, expiry, listLen);
+        auction->highestBid[auction->numItems - 1] = highestBid;
+    }
+    auction->version = version - journalLen;
+    for (unsigned long j = 0; j < journalLen; j++) {
+        record_change(auction, get_snapshot_name(&journal, &name, 
+                &nameCap));
+    }
+    free(name);
+    long historyLen;
+    const char* records = get_snapshot_bytes(&pos, &historyLen);
+    History* history = &auction->history;
+    history_open(history, data->historyPath);
+    if (history->fd == -1 && history->len == HISTORY_HEADER) {
+        history_load(history, records, historyLen);
+    }
+
+    // Until the old server has this, it may still carry on serving
+    char byte = 0;
+    if (!write_all(sock, &byte, 1)) {
+        fprintf(stderr, HANDOFF_ERR);
+        exit(HANDOFF_ERR_CODE);
+    }
+    close(sock);
+    free(snap);
+    free(fds);
+    report_port(data->fdServer);
+}
+
+/* handoff_resume_threads()
+* −−−−−−−−−−−−−−−
+* Starts a client thread for every connection taken over from the old 
+* server, with the input it had not yet processed already buffered.
+* 
+* data: A pointer to the AuctionData struct
+*/
+void handoff_resume_threads(AuctionData* data) {
+    Handoff* handoff = &data->handoff;
+    for (int c = 0; c < handoff->numConns; c++) {
+        HandoffConn* conn = &handoff->conns[c];
+        ThreadArgs* threadArgs = register_client(data, conn->fd, 
+                conn->client);
+        threadArgs->in = conn->in;
+        threadArgs->inLen = conn->inLen;
+        threadArgs->inCap = conn->inLen + 1;
+        pthread_t threadId;
+        pthread_create(&threadId, NULL, client_thread, threadArgs);
+        pthread_detach(threadId);
+    }
+    free(handoff->conns);
+    handoff->conns = NULL;
+    handoff->numConns = 0;
+}
+
+#ifdef HAVE_URING
+// One connection served by the io_uring loop. sendReap is the loop 
+// iteration its send in flight was queued in.
+typedef struct {
+    ThreadArgs* params;
+    char* in;
+    int inLen;
+    int inCap;
+    char* sending;
+    int sendLen;
+    int sendCap;
+    int sendOff;
+    bool sendArmed;
+    unsigned long sendReap;
+    bool recvArmed;
+    bool closing;
+} UringConn;
+
+// The io_uring instance, its provided receive buffers and connections
+typedef struct {
+    int fd;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    unsigned toSubmit;
+    struct io_uring_buf_ring* bufRing;
+    char* bufs;
+    unsigned short bufTail;
+    bool multishotAccept;
+    bool multishotRecv;
+    int acceptsArmed;
+    bool quiescing;
+    bool handoffPending;
+    unsigned long reaps;
+    UringConn** conns;
+    int connsSize;
+    int* waiting;
+    int numWaiting;
+    AuctionData* data;
+} Uring;
+
+/* uring_setup()
+* −−−−−−−−−−−−−−−
+* Creates the io_uring, maps its rings and registers a ring of provided
+* buffers for receives.
+* 
+* ring: The Uring to set up.
+*
+* Return: false if the kernel does not support what is needed
+*/
+bool uring_setup(Uring* ring) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (ring->fd < 0) {
+        return false;
+    }
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqSize = p.cq_off.cqes + p.cq_entries * 
+            sizeof(struct io_uring_cqe);
+    size_t sqeSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    size_t bufRingSize = URING_BUFS * sizeof(struct io_uring_buf);
+    char* sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, 
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    char* cq = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, 
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, sqeSize, PROT_READ | PROT_WRITE, 
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->bufRing = mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED ||
+            ring->bufRing == MAP_FAILED) {
+        close(ring->fd);
+        return false;
+    }
+    ring->sqHead = (unsigned*)(sq + p.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + p.sq_off.array);
+    ring->sqEntries = p.sq_entries;
+    ring->cqHead = (unsigned*)(cq + p.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    ring->toSubmit = 0;
+
+    // Provided buffer rings need Linux 5.19
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->bufRing;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+            &reg, 1) < 0) {
+        close(ring->fd);
+        return false;
+    }
+    ring->bufs = malloc(URING_BUFS * URING_BUF_SIZE);
+    ring->bufTail = 0;
+    for (int i = 0; i < URING_BUFS; i++) {
+        struct io_uring_buf* buf = &ring->bufRing->bufs[i];
+        buf->addr = (unsigned long)(ring->bufs + i * URING_BUF_SIZE);
+        buf->len = URING_BUF_SIZE;
+        buf->bid = i;
+        ring->bufTail++;
+    }
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+    ring->multishotAccept = true;
+    ring->multishotRecv = true;
+    return true;
+}
+
+/* uring_enter()
+* −−−−−−−−−−−−−−−
+* Submits all queued SQEs and optionally waits for completions, all in one
+* system call.
+* 
+* ring: The Uring.
+* wait: The number of completions to wait for.
+*/
+void uring_enter(Uring* ring, unsigned wait) {
+    while (1) {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->toSubmit, wait,
+                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0) {
+            ring->toSubmit -= ret;
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+    }
+}
+
+/* uring_sqe()
+* −−−−−−−−−−−−−−−
+* Returns a cleared SQE queued for the next submission, submitting first if
+* the submission ring is full.
+* 
+* ring: The Uring.
+* op: The URING_OP_* tag for the completion.
+* fd: The file descriptor the operation is on.
+*
+* Return: the SQE to fill in
+*/
+struct io_uring_sqe* uring_sqe(Uring* ring, int op, int fd) {
+    unsigned tail = *ring->sqTail;
+    if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= 
+            ring->sqEntries) {
+        uring_enter(ring, 0);
+    }
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fd;
+    sqe->user_data = ((unsigned long)fd << URING_OP_BITS) | op;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->toSubmit++;
+    return sqe;
+}
+
+/* uring_recycle()
+* −−−−−−−−−−−−−−−
+* Hands a provided receive buffer back to the kernel.
+* 
+* ring: The Uring.
+* bid: The buffer ID from the completion.
+*/
+void uring_recycle(Uring* ring, int bid) {
+    struct io_uring_buf* buf = 
+            &ring->bufRing->bufs[ring->bufTail & (URING_BUFS - 1)];
+    buf->addr = (unsigned long)(ring->bufs + bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ring->bufTail++;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+/* uring_accept()
+* −−−−−−−−−−−−−−−
+* Arms a (multishot if supported) accept on a listening socket.
+* 
+* ring: The Uring.
+* listenFd: The listening socket (TCP or Unix domain).
+*/
+void uring_accept(Uring* ring, int listenFd) {
+    struct io_uring_sqe* sqe = uring_sqe(ring, URING_OP_ACCEPT, listenFd);
+    sqe->opcode = IORING_OP_ACCEPT;
+    if (ring->multishotAccept) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    ring->acceptsArmed++;
+}
+
+/* uring_cancel()
+* −−−−−−−−−−−−−−−
+* Cancels the operation of a kind armed on a file descriptor.
+* 
+* ring: The Uring.
+* fd: The file descriptor.
+* op: The URING_OP_* tag of the operation.
+*/
+void uring_cancel(Uring* ring, int fd, int op) {
+    struct io_uring_sqe* sqe = uring_sqe(ring, URING_OP_CANCEL, fd);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = ((unsigned long)fd << URING_OP_BITS) | op;
+}
+
+/* uring_recv()
+* −−−−−−−−−−−−−−−
+* Arms a (multishot if supported) receive into the provided buffers.
+* 
+* ring: The Uring.
+* conn: The connection to receive on.
+*/
+void uring_recv(Uring* ring, UringConn* conn) {
+    struct io_uring_sqe* sqe = uring_sqe(ring, URING_OP_RECV, 
+            conn->params->fdptr);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    if (ring->multishotRecv) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    } else {
+        sqe->len = URING_BUF_SIZE;
+    }
+    conn->recvArmed = true;
+}
+
+/* uring_send()
+* −−−−−−−−−−−−−−−
+* Sends whatever output a connection has, unless a send is already in flight.
+* Responses queued while a send is in flight go out together in the next one.
+* 
+* ring: The Uring.
+* conn: The connection to send on.
+*/
+void uring_send(Uring* ring, UringConn* conn) {
+    if (conn->sendArmed) {
+        return;
+    }
+    ThreadArgs* params = conn->params;
+    if (conn->sendLen == 0) {
+        if (params->outLen == 0) {
+            return;
+        }
+        char* swap = conn->sending;
+        conn->sending = params->out;
+        conn->sendLen = params->outLen;
+        params->out = swap;
+        int swapCap = conn->sendCap;
+        conn->sendCap = params->outCap;
+        params->outCap = swapCap;
+        params->outLen = 0;
+        conn->sendOff = 0;
+    }
+    struct io_uring_sqe* sqe = uring_sqe(ring, URING_OP_SEND, 
+            conn->params->fdptr);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (unsigned long)(conn->sending + conn->sendOff);
+    sqe->len = conn->sendLen - conn->sendOff;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn->sendArmed = true;
+    conn->sendReap = ring->reaps;
+}
+
+/* uring_start()
+* −−−−−−−−−−−−−−−
+* Registers an accepted client and starts receiving from it.
+* 
+* ring: The Uring.
+* fd: The accepted file descriptor.
+* client: The registry id of a connection taken over from an old server, 
+* or 0 for a new client.
+*/
+void uring_start(Uring* ring, int fd, int client) {
+    if (fd >= ring->connsSize) {
+        int size = ring->connsSize;
+        while (fd >= ring->connsSize) {
+            ring->connsSize *= 2;
+        }
+        ring->conns = realloc(ring->conns, ring->connsSize * 
+                sizeof(UringConn*));
+        memset(ring->conns + size, 0, (ring->connsSize - size) * 
+                sizeof(UringConn*));
+    }
+    UringConn* conn = calloc(1, sizeof(UringConn));
+    conn->params = register_client(ring->data, fd, client);
+    ring->conns[fd] = conn;
+    if (!ring->quiescing) {
+        uring_recv(ring, conn);
+    }
+}
+
+/* uring_accepted()
+* −−−−−−−−−−−−−−−
+* Starts serving an accepted client, or parks it until a connection closes 
+* if --max connections are already being served.
+* 
+* ring: The Uring.
+* fd: The accepted file descriptor.
+*/
+void uring_accepted(Uring* ring, int fd) {
+    AuctionData* data = ring->data;
+    pthread_mutex_lock(&data->lock);
+    bool full = data->maxConnections != 0 && 
+            data->numCon >= data->maxConnections;
+    pthread_mutex_unlock(&data->lock);
+    if (full) {
+        ring->waiting = realloc(ring->waiting, (ring->numWaiting + 1) * 
+                sizeof(int));
+        ring->waiting[ring->numWaiting++] = fd;
+    } else {
+        uring_start(ring, fd, 0);
+    }
+}
+
+/* uring_close()
+* −−−−−−−−−−−−−−−
+* Closes a connection once nothing is in flight on it, and starts the next
+* parked client if there is one.
+* 
+* ring: The Uring.
+* conn: The connection to close.
+*/
+void uring_close(Uring* ring, UringConn* conn) {
+    if (conn->recvArmed || conn->sendArmed) {
+        return;
+    }
+    int fd = conn->params->fdptr;
+    unregister_client(conn->params);
+    close(fd);
+    ring->conns[fd] = NULL;
+    free(conn->params->out);
+    free(conn->params);
+    free(conn->in);
+    free(conn->sending);
+    free(conn);
+    if (ring->numWaiting > 0 && !ring->quiescing) {
+        int next = ring->waiting[0];
+        ring->numWaiting--;
+        memmove(ring->waiting, ring->waiting + 1, ring->numWaiting * 
+                sizeof(int));
+        uring_start(ring, next, 0);
+    }
+}
+
+/* uring_input()
+* −−−−−−−−−−−−−−−
+* Processes every complete request line in received data and queues the
+* responses. A trailing partial line is kept for the next receive. A 
+* client is evicted instead if it is over --maxbacklog counting only output
+* the kernel has refused: a send submitted in an earlier iteration that is
+* still in flight (stream sends only complete once every byte is taken).
+* 
+* ring: The Uring.
+* conn: The connection the data arrived on.
+* buf: The received data.
+* len: The number of bytes received.
+*/
+void uring_input(Uring* ring, UringConn* conn, char* buf, int len) {
+    bool refused = conn->sendArmed && conn->sendReap != ring->reaps;
+    if (refused && client_backlogged(conn->params->fdptr, 
+            conn->params->outLen + conn->sendLen - conn->sendOff, 
+            conn->params->limits->maxBacklog)) {
+        conn->params->outLen = 0;
+        return;
+    }
+    char* end = buf + len;
+    while (buf < end) {
+        char* newline = memchr(buf, '\n', end - buf);
+        if (newline == NULL) {
+            append_bytes(&conn->in, &conn->inLen, &conn->inCap, buf, 
+                    end - buf);
+            break;
+        }
+        *newline = '\0';
+        char* line = buf;
+        if (conn->inLen > 0) {
+            append_bytes(&conn->in, &conn->inLen, &conn->inCap, buf, 
+                    newline - buf + 1);
+            line = conn->in;
+        }
+        queue_reply(conn->params, process_line(line, conn->params));
+        conn->inLen = 0;
+        buf = newline + 1;
+    }
+    uring_send(ring, conn);
+}
+
+/* uring_notices()
+* −−−−−−−−−−−−−−−
+* Moves the notices other threads have queued onto their clients' output,
+* behind any replies already queued there, and sends them.
+* 
+* ring: The Uring.
+*/
+void uring_notices(Uring* ring) {
+    AuctionData* data = ring->data;
+    Notices* notices = &data->notices;
+    pthread_mutex_lock(&data->auction->lock);
+    int off = 0;
+    int client, len;
+    char* notice;
+    while ((notice = next_notice(notices, &off, &client, &len)) != NULL) {
+        int fd = active_fd(client, data->clients, data->totalCon);
+        UringConn* conn = fd >= 0 && fd < ring->connsSize ? 
+                ring->conns[fd] : NULL;
+        if (conn && !conn->closing) {
+            ThreadArgs* params = conn->params;
+            append_bytes(&params->out, &params->outLen, &params->outCap, 
+                    notice, len);
+            uring_send(ring, conn);
+        }
+    }
+    notices->len = 0;
+    pthread_mutex_unlock(&data->auction->lock);
+}
+
+/* uring_notify()
+* −−−−−−−−−−−−−−−
+* Arms a poll on the wake pipe of the notice queue.
+* 
+* ring: The Uring.
+*/
+void uring_notify(Uring* ring) {
+    struct io_uring_sqe* sqe = uring_sqe(ring, URING_OP_NOTICE, 
+            ring->data->notices.wake[0]);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLIN;
+}
+
+/* uring_watch_handoff()
+* −−−−−−−−−−−−−−−
+* Arms a poll on the handoff wake pipe, if --handoff was given.
+* 
+* ring: The Uring.
+*/
+void uring_watch_handoff(Uring* ring) {
+    Handoff* handoff = &ring->data->handoff;
+    if (handoff->path != NULL) {
+        struct io_uring_sqe* sqe = uring_sqe(ring, URING_OP_WAKE, 
+                handoff->wake[0]);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+    }
+}
+
+void uring_complete(Uring* ring, struct io_uring_cqe* cqe);
+
+/* uring_reap()
+* −−−−−−−−−−−−−−−
+* Submits new operations, waits for at least one completion and handles 
+* every completion that is ready, then the notices they queued. Capture 
+* records are flushed first if the wait may block.
+* 
+* ring: The Uring.
+*/
+void uring_reap(Uring* ring) {
+    if (*ring->cqHead == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        capture_flush(&ring->data->capture);
+    }
+    uring_enter(ring, 1);
+    ring->reaps++;
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe cqe = ring->cqes[head & *ring->cqMask];
+        head++;
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+        uring_complete(ring, &cqe);
+    }
+    uring_notices(ring);
+}
+
+/* uring_busy()
+* −−−−−−−−−−−−−−−
+* Checks whether an accept, receive or send is still in flight.
+* 
+* ring: The Uring.
+*/
+bool uring_busy(Uring* ring) {
+    if (ring->acceptsArmed > 0) {
+        return true;
+    }
+    for (int fd = 0; fd < ring->connsSize; fd++) {
+        UringConn* conn = ring->conns[fd];
+        if (conn && (conn->recvArmed || conn->sendArmed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* uring_handoff_active()
+* −−−−−−−−−−−−−−−
+* Checks whether the handoff the io_uring loop is parking for is still 
+* going, rather than given up by the handoff thread.
+* 
+* data: A pointer to the AuctionData struct
+*/
+bool uring_handoff_active(AuctionData* data) {
+    pthread_mutex_lock(&data->lock);
+    bool active = data->handoff.active;
+    pthread_mutex_unlock(&data->lock);
+    return active;
+}
+
+/* uring_handoff()
+* −−−−−−−−−−−−−−−
+* Parks the io_uring loop for a handoff: cancels the accepts and receives,
+* finishes sending every queued response, then hands every connection 
+* (including parked ones beyond --max) with its unprocessed input to the 
+* handoff thread. Only returns if the successor failed to take over or the
+* handoff was given up, with the accepts and receives armed again.
+* 
+* ring: The Uring.
+*/
+void uring_handoff(Uring* ring) {
+    AuctionData* data = ring->data;
+    Handoff* handoff = &data->handoff;
+    ring->quiescing = true;
+    uring_cancel(ring, data->fdServer, URING_OP_ACCEPT);
+    if (data->fdUnix >= 0) {
+        uring_cancel(ring, data->fdUnix, URING_OP_ACCEPT);
+    }
+    for (int fd = 0; fd < ring->connsSize; fd++) {
+        if (ring->conns[fd] && ring->conns[fd]->recvArmed) {
+            uring_cancel(ring, fd, URING_OP_RECV);
+        }
+    }
+    // A send to a client that has stopped reading may never finish; the 
+    // handoff thread then gives up and wakes us through the notice pipe. 
+    // The cancelled accepts still have to come back before they are 
+    // armed again.
+    while (uring_busy(ring) && (ring->acceptsArmed > 0 || 
+            uring_handoff_active(data))) {
+        uring_reap(ring);
+    }
+    if (data->capture.fd != -1) {
+        capture_flush(&data->capture);
+    }
+    pthread_mutex_lock(&data->lock);
+    if (handoff->active) {
+        handoff->conns = realloc(handoff->conns, (ring->connsSize + 
+                ring->numWaiting) * sizeof(HandoffConn));
+        for (int fd = 0; fd < ring->connsSize; fd++) {
+            UringConn* conn = ring->conns[fd];
+            if (conn) {
+                HandoffConn parked = {.fd = fd, 
+                        .client = conn->params->client, .in = conn->in, 
+                        .inLen = conn->inLen};
+                handoff->conns[handoff->numConns++] = parked;
+            }
+        }
+        for (int w = 0; w < ring->numWaiting; w++) {
+            HandoffConn parked = {.fd = ring->waiting[w], .client = 0, 
+                    .in = NULL, 
+                    .inLen = 0};
+            handoff->conns[handoff->numConns++] = parked;
+        }
+        handoff->loopParked = true;
+        pthread_cond_broadcast(&data->slotFree);
+        unsigned long failures = handoff->failures;
+        while (handoff->failures == failures) {
+            pthread_cond_wait(&data->slotFree, &data->lock);
+        }
+    }
+    bool full = data->maxConnections != 0 && 
+            data->numCon >= data->maxConnections;
+    pthread_mutex_unlock(&data->lock);
+
+    ring->quiescing = false;
+    uring_accept(ring, data->fdServer);
+    if (data->fdUnix >= 0) {
+        uring_accept(ring, data->fdUnix);
+    }
+    uring_watch_handoff(ring);
+    for (int fd = 0; fd < ring->connsSize; fd++) {
+        UringConn* conn = ring->conns[fd];
+        if (conn && !conn->recvArmed && !conn->closing) {
+            uring_recv(ring, conn);
+        }
+    }
+    // Slots freed while quiescing were not handed on
+    if (ring->numWaiting > 0 && !full) {
+        int next = ring->waiting[0];
+        ring->numWaiting--;
+        memmove(ring->waiting, ring->waiting + 1, ring->numWaiting * 
+                sizeof(int));
+        uring_start(ring, next, 0);
+    }
+}
+
+/* uring_complete()
+* −−−−−−−−−−−−−−−
+* Handles one completion.
+* 
+* ring: The Uring.
+* cqe: A copy of the completion.
+*/
+void uring_complete(Uring* ring, struct io_uring_cqe* cqe) {
+    int op = cqe->user_data & ((1 << URING_OP_BITS) - 1);
+    int fd = cqe->user_data >> URING_OP_BITS;
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    if (op == URING_OP_ACCEPT) {
+        if (cqe->res >= 0) {
+            uring_accepted(ring, cqe->res);
+        } else if (cqe->res == -EINVAL && ring->multishotAccept) {
+            ring->multishotAccept = false;
+        } else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED &&
+                cqe->res != -ECANCELED) {
+            errno = -cqe->res;
+            perror("Error accepting connection");
+            exit(1);
+        }
+        if (!more) {
+            ring->acceptsArmed--;
+            if (!ring->quiescing) {
+                uring_accept(ring, fd);
+            }
+        }
+        return;
+    } else if (op == URING_OP_CANCEL) {
+        return;
+    } else if (op == URING_OP_WAKE) {
+        // Parked from uring_connections() once this batch is handled, as
+        // parking reaps completions itself
+        ring->handoffPending = true;
+        return;
+    } else if (op == URING_OP_NOTICE) {
+        char bytes[CLIENT_BUF_SIZE];
+        while (read(fd, bytes, sizeof(bytes)) > 0) {
+        }
+        uring_notify(ring);
+        return;
+    }
+    UringConn* conn = ring->conns[fd];
+    if (op == URING_OP_RECV) {
+        if (cqe->res > 0) {
+            int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uring_input(ring, conn, ring->bufs + bid * URING_BUF_SIZE, 
+                    cqe->res);
+            uring_recycle(ring, bid);
+        } else if (cqe->res == -EINVAL && ring->multishotRecv) {
+            ring->multishotRecv = false;
+        } else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+            conn->closing = true;
+        }
+        if (!more) {
+            conn->recvArmed = false;
+            if (!conn->closing && !ring->quiescing) {
+                uring_recv(ring, conn);
+            }
+        }
+    } else {
+        conn->sendArmed = false;
+        if (cqe->res < 0) {
+            conn->sendLen = 0;
+            conn->params->outLen = 0;
+        } else {
+            conn->sendOff += cqe->res;
+            if (conn->sendOff == conn->sendLen) {
+                conn->sendLen = 0;
+            }
+            uring_send(ring, conn);
+        }
+    }
+    if (conn->closing) {
+        uring_close(ring, conn);
+    }
+}
+
+/* uring_connections()
+* −−−−−−−−−−−−−−−
+* Serves every client from a single thread using io_uring: a multishot 
+* accept, multishot receives into provided buffers, and one send in flight
+* per connection carrying all responses queued for it. Each loop iteration
+* submits all new operations and reaps completions in one system call.
+* Requests go through the same process_line() as client_thread().
+* 
+* data: A pointer to the AuctionData struct
+*
+* Return: false (without serving anything) if io_uring is unavailable
+* Errors: if the socket cant be accepted
+*/
+bool uring_connections(AuctionData* data) {
+    Uring* ring = calloc(1, sizeof(Uring));
+    if (!uring_setup(ring)) {
+        free(ring);
+        return false;
+    }
+    ring->data = data;
+    ring->connsSize = URING_ENTRIES;
+    ring->conns = calloc(ring->connsSize, sizeof(UringConn*));
+    // From here on notices for clients are queued for this thread
+    int wake[2];
+    if (pipe(wake) == 0) {
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, O_NONBLOCK);
+        pthread_mutex_lock(&data->auction->lock);
+        data->notices.wake[0] = wake[0];
+        data->notices.wake[1] = wake[1];
+        data->notices.loop = pthread_self();
+        pthread_mutex_unlock(&data->auction->lock);
+        uring_notify(ring);
+    }
+    uring_accept(ring, data->fdServer);
+    if (data->fdUnix >= 0) {
+        uring_accept(ring, data->fdUnix);
+    }
+    Handoff* handoff = &data->handoff;
+    uring_watch_handoff(ring);
+    // Connections taken over from an old server
+    for (int c = 0; c < handoff->numConns; c++) {
+        HandoffConn* conn = &handoff->conns[c];
+        uring_start(ring, conn->fd, conn->client);
+        uring_input(ring, ring->conns[conn->fd], conn->in, conn->inLen);
+        free(conn->in);
+    }
+    free(handoff->conns);
+    handoff->conns = NULL;
+    handoff->numConns = 0;
+    while (1) {
+        uring_reap(ring);
+        if (ring->handoffPending) {
+            ring->handoffPending = false;
+            uring_handoff(ring);
+        }
+    }
+    return true;
+}
+#else
+/* uring_connections()
+* −−−−−−−−−−−−−−−
+* io_uring support was not compiled in.
+* 
+* data: A pointer to the AuctionData struct
+*
+* Return: false
+*/
+bool uring_connections(AuctionData* data) {
+    (void)data;
+    return false;
+}
+#endif
+
 /* init_stat()
 * −----------------
 * Initializes the given Stat struct with default values.
@@ -674,12 +3921,9 @@ void* signal_thread(void* arg) {
         fprintf(stderr, "Connected clients: %u\n", data->numCon);
         fprintf(stderr, "Completed clients: %u\n", data->totalCon - 
                 data->numCon);
-        int activeAuctions = 0;
-        for (int i = 0; i < data->auction->numItems; i++) {
-            if (!data->auction->items[i].removed) {
-                activeAuctions++;
-            }
-        }
+        pthread_mutex_lock(&data->auction->lock);
+        int activeAuctions = data->auction->numItems;
+        pthread_mutex_unlock(&data->auction->lock);
         fprintf(stderr, "Active auctions: %u\n", activeAuctions);
         fprintf(stderr, "Total sell requests: %u\n", data->stats->sellRequest);
         fprintf(stderr, "Successful sell requests: %u\n", data->stats->
@@ -701,15 +3945,25 @@ void* signal_thread(void* arg) {
 * argv: Array of command line arguments
 */
 int main(int argc, char* argv[]) {
-    AuctionData* data = malloc(sizeof(AuctionData));
+    AuctionData* data = calloc(1, sizeof(AuctionData));
     pthread_mutex_init(&data->lock, NULL);
-    data->auction = malloc(sizeof(Auction));
+    pthread_cond_init(&data->slotFree, NULL);
+    data->auction = calloc(1, sizeof(Auction));
     data->stats = malloc(sizeof(Stat));
     data->clients = malloc(sizeof(ActiveClient));
+    data->notices.wake[0] = -1;
+    data->notices.wake[1] = -1;
     init_stat(data->stats);
     pthread_mutex_init(&data->auction->lock, NULL);
+    clock_init(data->auction);
 
     check_command_line(data, argc, argv);
+    capture_open(&data->capture);
+    if (data->handoff.takeoverPath) {
+        takeover(data);
+    } else {
+        history_open(&data->auction->history, data->historyPath);
+    }
 
     pthread_t tid;
     pthread_create(&tid, NULL, signal_thread, data);
@@ -720,10 +3974,25 @@ int main(int argc, char* argv[]) {
     sigaddset(&set, SIGHUP);
     pthread_sigmask(SIG_BLOCK, &set, NULL);
     // End GPT produced code
+    // A client vanishing before its reply is written must not kill the 
+    // server; Unix domain sockets raise SIGPIPE on the first such write
+    signal(SIGPIPE, SIG_IGN);
     pthread_t expiryThread;
     pthread_create(&expiryThread, NULL, expiry_thread, data);
-    connect_port(data);
-    process_connections(data);
+    if (!data->handoff.takeoverPath) {
+        connect_unix(data);
+        connect_port(data);
+    }
+    handoff_listen(data);
+    if (!data->useUring || !uring_connections(data)) {
+        handoff_resume_threads(data);
+        if (data->fdUnix >= 0) {
+            pthread_t unixThread;
+            pthread_create(&unixThread, NULL, unix_thread, data);
+            pthread_detach(unixThread);
+        }
+        process_connections(data, data->fdServer);
+    }
     pthread_join(expiryThread, NULL);
 }
 
@@ -0,0 +1,644 @@
+/*
+ * Auction Replay
+ * Replays an auctioneer capture trace against a server and reports latency
+ * Created by: Adnaan Buksh
+ * Student number: 47435568
+ */
+
+// includes
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <signal.h>
+
+// constants
+#define USAGE_ERR "Usage: auctionreplay [--speed factor] trace \
+(portno | --unix path)\n"
+#define USAGE_ERR_CODE 20
+#define CONNECTION_ERR "auctionreplay: cannot connect to port %s\n"
+#define CONNECTION_ERR_CODE 13
+#define UNIX_CONNECTION_ERR "auctionreplay: cannot connect to socket %s\n"
+#define TRACE_ERR "auctionreplay: trace %s can't be read\n"
+#define TRACE_ERR_CODE 14
+#define LOCALHOST "localhost"
+#define UNIX "--unix"
+#define SPEED "--speed"
+#define CAPTURE_MAGIC "AUCTRC01"
+#define CAPTURE_MAGIC_LEN 8
+#define SESSION_TABLE_MIN 64
+#define MIN_PENDING 16
+#define READ_BUFFER 65536
+#define MAX_EVENTS 64
+#define DRAIN_SECS 5
+#define NUM_PERCENTILES 5
+
+// One captured request line, or the end of a session (len -1)
+typedef struct {
+    long time;
+    unsigned long session;
+    int index;
+    const char* line;
+    int len;
+    long seq;
+} Record;
+
+// A replayed client connection, connected at its first record. pending 
+// holds the send times of requests still waiting for their reply, oldest at
+// head.
+typedef struct {
+    unsigned long id;
+    int fd;
+    bool closed;
+    double* pending;
+    int head;
+    int tail;
+    int cap;
+    char* in;
+    int inLen;
+} Session;
+
+// Structure that holds all the data for a replay
+typedef struct {
+    const char* tracePath;
+    const char* portName;
+    const char* unixPath;
+    double speed;
+    Record* records;
+    long numRecords;
+    Session* sessions;
+    int numSessions;
+    int epollFd;
+    unsigned long sent;
+    unsigned long answered;
+    unsigned long notices;
+    double* latencies;
+    unsigned long latenciesCap;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+} ReplayData;
+
+// functions
+
+/* usage_err()
+* −----------------
+* Throws usage error
+*/
+void usage_err() {
+    fprintf(stderr, USAGE_ERR);
+    exit(USAGE_ERR_CODE);
+}
+
+/* trace_err()
+* −----------------
+* Throws trace error
+*
+* path: The trace path.
+*/
+void trace_err(const char* path) {
+    fprintf(stderr, TRACE_ERR, path);
+    exit(TRACE_ERR_CODE);
+}
+
+/* now_secs()
+* −−−−−−−−−−−−−−−
+* Returns: the monotonic time in seconds
+*/
+double now_secs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* get_varint()
+* −−−−−−−−−−−−−−−
+* Reads an unsigned LEB128 varint, failing if it runs past the end.
+*
+* pos: The read position, advanced past the varint.
+* end: The end of the data.
+* value: Where to store the value.
+*
+* Returns: false if the varint is truncated
+*/
+bool get_varint(const unsigned char** pos, const unsigned char* end,
+        unsigned long* value) {
+    *value = 0;
+    for (int shift = 0; *pos < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*pos)++;
+        *value |= (unsigned long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* compare_records()
+* −−−−−−−−−−−−−−−
+* qsort() order of records: by time, then by position in the trace.
+*/
+int compare_records(const void* a, const void* b) {
+    const Record* x = a;
+    const Record* y = b;
+    if (x->time != y->time) {
+        return x->time < y->time ? -1 : 1;
+    }
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/* compare_latencies()
+* −−−−−−−−−−−−−−−
+* qsort() order of latencies.
+*/
+int compare_latencies(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* number_sessions()
+* −−−−−−−−−−−−−−−
+* Gives each distinct session id in the trace an index into the session
+* array, using an open-addressing table of index + 1 by id.
+*
+* data: The replay data.
+*/
+void number_sessions(ReplayData* data) {
+    int size = SESSION_TABLE_MIN;
+    while (size < data->numRecords * 2) {
+        size *= 2;
+    }
+    int* table = calloc(size, sizeof(int));
+    int cap = MIN_PENDING;
+    data->sessions = malloc(cap * sizeof(Session));
+    data->numSessions = 0;
+    for (long r = 0; r < data->numRecords; r++) {
+        Record* record = &data->records[r];
+        unsigned long i = (record->session * 0x9e3779b97f4a7c15ul) &
+                (size - 1);
+        while (table[i] != 0 &&
+                data->sessions[table[i] - 1].id != record->session) {
+            i = (i + 1) & (size - 1);
+        }
+        if (table[i] == 0) {
+            if (data->numSessions == cap) {
+                cap *= 2;
+                data->sessions = realloc(data->sessions, 
+                        cap * sizeof(Session));
+            }
+            Session* session = &data->sessions[data->numSessions];
+            memset(session, 0, sizeof(Session));
+            session->id = record->session;
+            session->fd = -1;
+            table[i] = ++data->numSessions;
+        }
+        record->index = table[i] - 1;
+    }
+    free(table);
+}
+
+/* load_trace()
+* −−−−−−−−−−−−−−−
+* Reads a capture trace into time order and numbers its sessions. Threads
+* of the server append their records in batches, so the trace is only in
+* order within each session.
+*
+* data: The replay data.
+*
+* Errors: if the trace can't be read or is malformed
+*/
+void load_trace(ReplayData* data) {
+    int fd = open(data->tracePath, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1 ||
+            info.st_size < CAPTURE_MAGIC_LEN) {
+        trace_err(data->tracePath);
+    }
+    unsigned char* trace = malloc(info.st_size);
+    long got = 0;
+    while (got < info.st_size) {
+        ssize_t n = read(fd, trace + got, info.st_size - got);
+        if (n <= 0) {
+            trace_err(data->tracePath);
+        }
+        got += n;
+    }
+    close(fd);
+    if (memcmp(trace, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+        trace_err(data->tracePath);
+    }
+
+    const unsigned char* pos = trace + CAPTURE_MAGIC_LEN;
+    const unsigned char* end = trace + info.st_size;
+    long cap = MIN_PENDING;
+    data->records = malloc(cap * sizeof(Record));
+    data->numRecords = 0;
+    while (pos < end) {
+        unsigned long time, session, len;
+        if (!get_varint(&pos, end, &time) ||
+                !get_varint(&pos, end, &session) ||
+                !get_varint(&pos, end, &len) ||
+                (len > 0 && len - 1 > (unsigned long)(end - pos))) {
+            trace_err(data->tracePath);
+        }
+        if (data->numRecords == cap) {
+            cap *= 2;
+            data->records = realloc(data->records, cap * sizeof(Record));
+        }
+        Record record = {.time = time, .session = session, .index = -1,
+                .line = (const char*)pos, .len = (int)len - 1,
+                .seq = data->numRecords};
+        data->records[data->numRecords++] = record;
+        pos += len > 0 ? len - 1 : 0;
+    }
+    qsort(data->records, data->numRecords, sizeof(Record), compare_records);
+    number_sessions(data);
+}
+
+/* connect_unix()
+* −−−−−−−−−−−−−−−
+* Connects to the auctioneer's Unix domain socket. A path starting with '@'
+* names a socket in the abstract namespace.
+*
+* path: The socket path.
+*
+* Returns: the connected socket
+* Errors: if the path is too long or the socket can't be connected to
+*/
+int connect_unix(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int pathLen = strlen(path);
+    if (pathLen >= (int)sizeof(addr.sun_path)) {
+        fprintf(stderr, UNIX_CONNECTION_ERR, path);
+        exit(CONNECTION_ERR_CODE);
+    }
+    memcpy(addr.sun_path, path, pathLen);
+    socklen_t addrLen = offsetof(struct sockaddr_un, sun_path) + pathLen;
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+    } else {
+        addrLen++;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*)&addr, addrLen)) {
+        fprintf(stderr, UNIX_CONNECTION_ERR, path);
+        exit(CONNECTION_ERR_CODE);
+    }
+    return fd;
+}
+
+/* connect_tcp()
+* −−−−−−−−−−−−−−−
+* Connects to the auctioneer on the given port of localhost.
+*
+* portName: The port number.
+*
+* Returns: the connected socket
+* Errors: if the port can't be connected to
+*/
+int connect_tcp(const char* portName) {
+    struct addrinfo* ai = NULL;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET; //IPv4
+    hints.ai_socktype = SOCK_STREAM; //TCP
+    if (getaddrinfo(LOCALHOST, portName, &hints, &ai)) {
+        fprintf(stderr, CONNECTION_ERR, portName);
+        exit(CONNECTION_ERR_CODE);
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, ai->ai_addr, sizeof(struct sockaddr))) {
+        fprintf(stderr, CONNECTION_ERR, portName);
+        exit(CONNECTION_ERR_CODE);
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/* command_line_check()
+* −−−−−−−−−−−−−−−
+* Checks the command line arguments and fills in the replay data.
+*
+* data: The replay data.
+* argc: The number of command line arguments.
+* argv: The array of command line arguments.
+*
+* Errors: if an argument is missing, repeated or invalid
+*/
+void command_line_check(ReplayData* data, int argc, char* argv[]) {
+    bool setSpeed = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], SPEED) == 0 && i + 1 < argc && !setSpeed) {
+            char* end;
+            data->speed = strtod(argv[++i], &end);
+            if (*argv[i] == '\0' || *end != '\0' || !(data->speed >= 0)) {
+                usage_err();
+            }
+            setSpeed = true;
+        } else if (strcmp(argv[i], UNIX) == 0 && i + 1 < argc &&
+                data->tracePath && !data->unixPath && !data->portName &&
+                argv[i + 1][0] != '\0') {
+            data->unixPath = argv[++i];
+        } else if (!data->tracePath && argv[i][0] != '\0') {
+            data->tracePath = argv[i];
+        } else if (!data->unixPath && !data->portName) {
+            data->portName = argv[i];
+        } else {
+            usage_err();
+        }
+    }
+    if (!data->tracePath || (!data->unixPath && !data->portName)) {
+        usage_err();
+    }
+}
+
+/* write_all()
+* −−−−−−−−−−−−−−−
+* Writes a whole buffer to a socket.
+*
+* fd: The socket.
+* buf: The bytes to write.
+* len: The number of bytes.
+*
+* Return: false if the socket failed
+*/
+bool write_all(int fd, const char* buf, long len) {
+    while (len > 0) {
+        ssize_t done = send(fd, buf, len, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        buf += done;
+        len -= done;
+    }
+    return true;
+}
+
+/* take_reply()
+* −−−−−−−−−−−−−−−
+* Matches a reply line from the server to the oldest unanswered request of
+* its session and records the latency. :outbid, :sold, :won and :unsold are
+* notifications, not replies. Caller holds the lock.
+*
+* data: The replay data.
+* session: The session the line arrived on.
+* line: The line.
+* now: When it arrived.
+*/
+void take_reply(ReplayData* data, Session* session, const char* line,
+        double now) {
+    if (strncmp(line, ":outbid ", 8) == 0 ||
+            strncmp(line, ":sold ", 6) == 0 ||
+            strncmp(line, ":won ", 5) == 0 ||
+            strncmp(line, ":unsold ", 8) == 0) {
+        data->notices++;
+        return;
+    }
+    if (session->head == session->tail) {
+        return;
+    }
+    if (data->answered == data->latenciesCap) {
+        data->latenciesCap = data->latenciesCap ? data->latenciesCap * 2 :
+                MIN_PENDING;
+        data->latencies = realloc(data->latencies, data->latenciesCap *
+                sizeof(double));
+    }
+    double sentAt = session->pending[session->head++ % session->cap];
+    data->latencies[data->answered++] = now - sentAt;
+}
+
+/* session_input()
+* −−−−−−−−−−−−−−−
+* Reads what the server sent on a session and takes every complete line.
+* At end of file the session is closed and its unanswered requests are
+* dropped.
+*
+* data: The replay data.
+* session: The readable session.
+*/
+void session_input(ReplayData* data, Session* session) {
+    ssize_t got = read(session->fd, session->in + session->inLen,
+            READ_BUFFER - session->inLen);
+    double now = now_secs();
+    if (got < 0 && errno == EINTR) {
+        return;
+    }
+    pthread_mutex_lock(&data->lock);
+    if (got <= 0) {
+        epoll_ctl(data->epollFd, EPOLL_CTL_DEL, session->fd, NULL);
+        close(session->fd);
+        session->closed = true;
+        data->sent -= session->tail - session->head;
+        session->head = session->tail;
+        pthread_cond_signal(&data->progress);
+        pthread_mutex_unlock(&data->lock);
+        return;
+    }
+    session->inLen += got;
+    char* start = session->in;
+    char* newline;
+    while ((newline = memchr(start, '\n', session->in + session->inLen -
+            start)) != NULL) {
+        *newline = '\0';
+        take_reply(data, session, start, now);
+        start = newline + 1;
+    }
+    session->inLen -= start - session->in;
+    memmove(session->in, start, session->inLen);
+    if (session->inLen == READ_BUFFER) {
+        // A line longer than the buffer: drop it and count it as a reply
+        take_reply(data, session, "", now);
+        session->inLen = 0;
+    }
+    pthread_cond_signal(&data->progress);
+    pthread_mutex_unlock(&data->lock);
+}
+
+/* receive_thread()
+* −−−−−−−−−−−−−−−
+* Thread that reads replies from every session as they arrive, so the
+* latency measured does not depend on the pace of sending.
+*
+* arg: A void pointer to the replay data.
+*
+* Return: NULL
+*/
+void* receive_thread(void* arg) {
+    ReplayData* data = (ReplayData*)arg;
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(data->epollFd, events, MAX_EVENTS, -1);
+        for (int e = 0; e < n; e++) {
+            session_input(data, events[e].data.ptr);
+        }
+    }
+    return NULL;
+}
+
+/* wait_until()
+* −−−−−−−−−−−−−−−
+* Sleeps until the given monotonic time.
+*
+* when: The time in seconds.
+*/
+void wait_until(double when) {
+    struct timespec until = {.tv_sec = (time_t)when,
+            .tv_nsec = (long)((when - (time_t)when) * 1e9)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) ==
+            EINTR) {
+    }
+}
+
+/* send_record()
+* −−−−−−−−−−−−−−−
+* Sends a request of the trace on its session, connecting the session
+* first if this is its first record, or shuts down the sending side of the
+* session at its end.
+*
+* data: The replay data.
+* record: The record to replay.
+*/
+void send_record(ReplayData* data, Record* record) {
+    Session* session = &data->sessions[record->index];
+    if (session->fd == -1) {
+        session->fd = data->unixPath ? connect_unix(data->unixPath) :
+                connect_tcp(data->portName);
+        session->in = malloc(READ_BUFFER);
+        struct epoll_event event = {.events = EPOLLIN,
+                .data.ptr = session};
+        epoll_ctl(data->epollFd, EPOLL_CTL_ADD, session->fd, &event);
+    }
+    pthread_mutex_lock(&data->lock);
+    // Once the server has closed the session its descriptor may be reused
+    if (session->closed) {
+        pthread_mutex_unlock(&data->lock);
+        return;
+    }
+    if (record->len < 0) {
+        shutdown(session->fd, SHUT_WR);
+        pthread_mutex_unlock(&data->lock);
+        return;
+    }
+    if (session->tail - session->head == session->cap) {
+        int cap = session->cap ? session->cap * 2 : MIN_PENDING;
+        double* pending = malloc(cap * sizeof(double));
+        for (int p = session->head; p < session->tail; p++) {
+            pending[p - session->head] = session->pending[p % session->cap];
+        }
+        free(session->pending);
+        session->pending = pending;
+        session->tail -= session->head;
+        session->head = 0;
+        session->cap = cap;
+    }
+    session->pending[session->tail++ % session->cap] = now_secs();
+    data->sent++;
+    pthread_mutex_unlock(&data->lock);
+    // Records can be as long as the trace allows, so not on the stack
+    char* line = malloc(record->len + 1);
+    memcpy(line, record->line, record->len);
+    line[record->len] = '\n';
+    write_all(session->fd, line, record->len + 1);
+    free(line);
+}
+
+/* report()
+* −−−−−−−−−−−−−−−
+* Prints the reply count, throughput and latency percentiles.
+*
+* data: The replay data.
+* elapsed: Seconds from the first request to the last reply.
+*/
+void report(ReplayData* data, double elapsed) {
+    unsigned long n = data->answered;
+    printf("requests %lu answered %lu notifications %lu in %.3fs",
+            data->sent, n, data->notices, elapsed);
+    printf(" (%.0f/s)\n", elapsed > 0 ? n / elapsed : 0.0);
+    if (n == 0) {
+        return;
+    }
+    qsort(data->latencies, n, sizeof(double), compare_latencies);
+    double percentiles[NUM_PERCENTILES] = {50, 90, 99, 99.9, 100};
+    const char* names[NUM_PERCENTILES] = {"p50", "p90", "p99", "p99.9",
+            "max"};
+    printf("latency us:");
+    for (int p = 0; p < NUM_PERCENTILES; p++) {
+        unsigned long rank = (unsigned long)(percentiles[p] / 100 * n);
+        printf(" %s %.1f", names[p],
+                data->latencies[rank < n ? rank : n - 1] * 1e6);
+    }
+    printf("\n");
+}
+
+/* main()
+* −----------------
+* Main function of the program
+* Loads the trace, then replays its requests on one connection per
+* captured session at the captured pace divided by the speed factor (0 for
+* as fast as possible), waits for the replies and prints a report.
+*
+* argc: The number of command line arguments.
+* argv: The array of command line arguments.
+*/
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    ReplayData data = {.tracePath = NULL, .portName = NULL,
+            .unixPath = NULL, .speed = 1, .sent = 0, .answered = 0,
+            .notices = 0, .latencies = NULL, .latenciesCap = 0,
+            .lock = PTHREAD_MUTEX_INITIALIZER,
+            .progress = PTHREAD_COND_INITIALIZER};
+    command_line_check(&data, argc, argv);
+    load_trace(&data);
+    data.epollFd = epoll_create1(0);
+
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receive_thread, &data);
+    double start = now_secs();
+    long firstTime = data.numRecords > 0 ? data.records[0].time : 0;
+    for (long r = 0; r < data.numRecords; r++) {
+        Record* record = &data.records[r];
+        if (data.speed > 0) {
+            wait_until(start + (record->time - firstTime) / 1e6 /
+                    data.speed);
+        }
+        send_record(&data, record);
+    }
+
+    // Wait for the outstanding replies, giving up after DRAIN_SECS without
+    // any arriving
+    pthread_mutex_lock(&data.lock);
+    while (data.answered < data.sent) {
+        unsigned long answered = data.answered;
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += DRAIN_SECS;
+        while (data.answered == answered && data.answered < data.sent &&
+                pthread_cond_timedwait(&data.progress, &data.lock, 
+                &until) != ETIMEDOUT) {
+        }
+        if (data.answered == answered && data.answered < data.sent) {
+            break;
+        }
+    }
+    report(&data, now_secs() - start);
+    pthread_mutex_unlock(&data.lock);
+    return 0;
+}
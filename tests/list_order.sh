@@ -0,0 +1,37 @@
+#!/bin/bash
+# Checks that closing an item in the middle of the auction leaves the
+# remaining items listed in the order they were submitted.
+# usage: tests/list_order.sh [path to auctioneer] [extra auctioneer args]
+
+AUCTIONEER=${1:-./auctioneer}
+shift
+
+"$AUCTIONEER" "$@" 2> >(head -n 1 > port.$$) &
+server=$!
+trap 'kill $server 2>/dev/null; rm -f port.$$' EXIT
+while [ ! -s port.$$ ]; do
+    sleep 0.1
+done
+port=$(cat port.$$)
+
+exec 3<>/dev/tcp/localhost/"$port"
+printf 'sell first 5 100\nsell middle 5 1\nsell third 5 100\nsell last 5 100\n' >&3
+for i in 1 2 3 4; do
+    read -r line <&3
+done
+sleep 2
+read -r line <&3
+if [ "$line" != ":unsold middle" ]; then
+    echo "FAIL: expected :unsold middle, got $line"
+    exit 1
+fi
+printf 'list\n' >&3
+read -r line <&3
+# Keep just the names; the time left depends on how long this took
+line=$(echo "$line" | sed 's/ [0-9]* [0-9]* [0-9]*|/|/g')
+expected=":list first|third|last|"
+if [ "$line" != "$expected" ]; then
+    echo "FAIL: expected $expected, got $line"
+    exit 1
+fi
+echo "PASS"